@@ -1,9 +1,18 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <string>
-#include <fstream>
-#include <iostream>
-#include <sstream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <new>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
 using namespace std;
 
@@ -11,16 +20,252 @@ using namespace std;
 
 using Byte = unsigned char; // 8 bit
 using Word = unsigned short; // 16 bit
+using u16 = unsigned short;
 using u32 = unsigned int;
+using s16 = signed short;
+using s32 = signed int;
+using s64 = signed long long;
+using u64 = unsigned long long;
+
+// Undo log of memory writes kept in a preallocated ring. Once the ring wraps, marks older
+// than its capacity can no longer be rolled back to.
+struct JOURNAL {
+    struct ENTRY {
+        Word Address;
+        Byte Old;
+    };
+
+    static constexpr u64 MAX_CAPACITY = 1ull << 32;
+
+    ENTRY* Entries = nullptr;
+    u64 Capacity = 0; // Power of two
+    u64 Head = 0; // Entries recorded since Initialize
+
+    ~JOURNAL() {
+        free(Entries);
+    }
+
+    bool Initialize(u64 capacity) {
+        if (capacity > MAX_CAPACITY) {
+            return false;
+        }
+        Capacity = 1;
+        while (Capacity < capacity) {
+            Capacity <<= 1;
+        }
+        free(Entries);
+        Entries = (ENTRY*)malloc(Capacity * sizeof(ENTRY));
+        Head = 0;
+        return Entries != nullptr;
+    }
+
+    void Record(Word Address, Byte Old) {
+        ENTRY& entry = Entries[Head & (Capacity - 1)];
+        entry.Address = Address;
+        entry.Old = Old;
+        Head++;
+    }
+
+    u64 Mark() const {
+        return Head;
+    }
+
+    bool Reachable(u64 mark) const {
+        return mark <= Head && Head - mark <= Capacity;
+    }
+
+    const ENTRY& At(u64 index) const {
+        return Entries[index & (Capacity - 1)];
+    }
+};
 
 struct MEMORY {
     static constexpr u32 MAX_MEMORY = 1024 * 64;
+    static constexpr u32 PAGE_SIZE = 256;
+    static constexpr u32 PAGE_COUNT = MAX_MEMORY / PAGE_SIZE;
+
+    // Page flags
+    static constexpr Byte PAGE_DIRTY = 0b00000001; // Written since the last checkpoint
+    static constexpr Byte PAGE_WATCH_READ = 0b00000010; // Holds a read watchpoint
+    static constexpr Byte PAGE_WATCH_WRITE = 0b00000100; // Holds a write watchpoint
+    static constexpr Byte PAGE_BREAKPOINT = 0b00001000; // Holds a PC breakpoint
+    static constexpr Byte PAGE_JOURNAL = 0b00010000; // Writes are recorded in Journal
+    static constexpr Byte PAGE_DEVICE = 0b00100000; // Writes are forwarded to a device
+
     Byte Data[MAX_MEMORY];
+    Byte PageFlags[PAGE_COUNT];
+
+    // One bit per address, only consulted on pages whose flag is set
+    Byte Breakpoints[MAX_MEMORY / 8];
+    Byte ReadWatches[MAX_MEMORY / 8];
+    Byte WriteWatches[MAX_MEMORY / 8];
+
+    bool WatchHit;
+    bool WatchWasWrite;
+    Word WatchAddress;
+
+    JOURNAL* Journal = nullptr;
+
+    // Kinds of bus cycle reported to Listener by the cycle exact engine
+    static constexpr Byte
+        BUS_OPCODE = 0, // Opcode fetch
+        BUS_READ = 1,
+        BUS_WRITE = 2,
+        BUS_DUMMY_READ = 3, // Internal cycle, value discarded
+        BUS_DUMMY_WRITE = 4; // Read-modify-write storing the unmodified value
+
+    void (*Listener)(void* context, Word address, Byte data, Byte kind) = nullptr;
+    void* ListenerContext = nullptr;
+
+    // Memory mapped devices, per page. Writes still land in Data so reads see the last value.
+    void (*DeviceWrite[PAGE_COUNT])(void* context, Word address, Byte value) = {};
+    void* DeviceContext[PAGE_COUNT] = {};
 
     void Initialize() {
         for (u32 i = 0; i < MAX_MEMORY; i++) {
             Data[i] = 0;
         }
+        // Freshly cleared memory has never been checkpointed
+        for (u32 i = 0; i < PAGE_COUNT; i++) {
+            PageFlags[i] = PAGE_DIRTY
+                | (Journal != nullptr ? PAGE_JOURNAL : 0)
+                | (DeviceWrite[i] != nullptr ? PAGE_DEVICE : 0);
+        }
+        for (u32 i = 0; i < MAX_MEMORY / 8; i++) {
+            Breakpoints[i] = ReadWatches[i] = WriteWatches[i] = 0;
+        }
+        WatchHit = false;
+    }
+
+    static bool TestBit(const Byte* Bitmap, u32 Address) {
+        return (Bitmap[Address / 8] >> (Address % 8)) & 1;
+    }
+
+    void SetBit(Byte* Bitmap, Byte PageFlag, Word Address, bool enabled) {
+        if (enabled) {
+            Bitmap[Address / 8] |= 1 << (Address % 8);
+            PageFlags[Address / PAGE_SIZE] |= PageFlag;
+            return;
+        }
+
+        Bitmap[Address / 8] &= ~(1 << (Address % 8));
+
+        // Drop the page back onto the fast path once its last bit is gone
+        u32 First = (Address / PAGE_SIZE) * (PAGE_SIZE / 8);
+        for (u32 i = First; i < First + PAGE_SIZE / 8; i++) {
+            if (Bitmap[i] != 0) {
+                return;
+            }
+        }
+        PageFlags[Address / PAGE_SIZE] &= ~PageFlag;
+    }
+
+    void SetBreakpoint(Word Address, bool enabled = true) {
+        SetBit(Breakpoints, PAGE_BREAKPOINT, Address, enabled);
+    }
+
+    void SetReadWatch(Word Address, bool enabled = true) {
+        SetBit(ReadWatches, PAGE_WATCH_READ, Address, enabled);
+    }
+
+    void SetWriteWatch(Word Address, bool enabled = true) {
+        SetBit(WriteWatches, PAGE_WATCH_WRITE, Address, enabled);
+    }
+
+    bool IsBreakpoint(Word Address) const {
+        return (PageFlags[Address / PAGE_SIZE] & PAGE_BREAKPOINT) && TestBit(Breakpoints, Address);
+    }
+
+    void Watched(const Byte* Bitmap, u32 Address, bool write) {
+        if (TestBit(Bitmap, Address)) {
+            WatchHit = true;
+            WatchWasWrite = write;
+            WatchAddress = Address;
+        }
+    }
+
+    Byte Read(u32 Address) {
+        if (PageFlags[Address / PAGE_SIZE] & PAGE_WATCH_READ) {
+            Watched(ReadWatches, Address, false);
+        }
+        return Data[Address];
+    }
+
+    void AttachJournal(JOURNAL* journal) {
+        Journal = journal;
+        for (u32 i = 0; i < PAGE_COUNT; i++) {
+            if (Journal != nullptr)
+                PageFlags[i] |= PAGE_JOURNAL;
+            else {
+                PageFlags[i] &= ~PAGE_JOURNAL;
+            }
+        }
+    }
+
+    void MapDevice(u32 FirstPage, u32 Pages, void (*write)(void* context, Word address, Byte value), void* context) {
+        for (u32 i = FirstPage; i < FirstPage + Pages; i++) {
+            DeviceWrite[i] = write;
+            DeviceContext[i] = context;
+            PageFlags[i] |= PAGE_DEVICE;
+        }
+    }
+
+    // Every store goes through here, the page flags decide whether it needs the slow path
+    void Store(u32 Address, Byte value) {
+        Byte& Flags = PageFlags[Address / PAGE_SIZE];
+        if (Flags & (PAGE_WATCH_WRITE | PAGE_JOURNAL | PAGE_DEVICE)) {
+            if (Flags & PAGE_WATCH_WRITE) {
+                Watched(WriteWatches, Address, true);
+            }
+            if (Flags & PAGE_JOURNAL) {
+                Journal->Record(Address, Data[Address]);
+            }
+            if (Flags & PAGE_DEVICE) {
+                DeviceWrite[Address / PAGE_SIZE](DeviceContext[Address / PAGE_SIZE], Address, value);
+            }
+        }
+        Flags |= PAGE_DIRTY;
+        Data[Address] = value;
+    }
+
+    // Undoes every write recorded after mark
+    bool Rollback(u64 mark) {
+        if (Journal == nullptr || !Journal->Reachable(mark)) {
+            return false;
+        }
+        while (Journal->Head > mark) {
+            Journal->Head--;
+            const JOURNAL::ENTRY& entry = Journal->At(Journal->Head);
+            Data[entry.Address] = entry.Old;
+            PageFlags[entry.Address / PAGE_SIZE] |= PAGE_DIRTY;
+        }
+        return true;
+    }
+
+    // Writes "address value" for every address whose value differs from what it was at mark
+    bool WriteDelta(FILE* Output, u64 mark) const {
+        if (Journal == nullptr || !Journal->Reachable(mark)) {
+            return false;
+        }
+        Byte Seen[MAX_MEMORY / 8] = {};
+        for (u64 i = mark; i < Journal->Head; i++) {
+            const JOURNAL::ENTRY& entry = Journal->At(i);
+            if (TestBit(Seen, entry.Address)) {
+                continue;
+            }
+            Seen[entry.Address / 8] |= 1 << (entry.Address % 8);
+            // The first entry for an address holds its value at mark
+            if (Data[entry.Address] != entry.Old) {
+                fprintf(Output, "%d %d\n", entry.Address, Data[entry.Address]);
+            }
+        }
+        return true;
+    }
+
+    void ClearDirty() {
+        for (u32 i = 0; i < PAGE_COUNT; i++) {
+            PageFlags[i] &= ~PAGE_DIRTY;
+        }
     }
 
     Byte operator[] (u32 Address) const {
@@ -31,14 +276,14 @@ struct MEMORY {
         return Data[Address];
     }
 
-    void WriteWord(Word value, u32 Address, u32& ticks) {
-        Data[Address] = value & 0xFF;
-        Data[Address + 1] = (value >> 8);
+    void WriteWord(Word value, u32 Address, s32& ticks) {
+        Store(Address, value & 0xFF);
+        Store((Address + 1) % MAX_MEMORY, value >> 8);
         ticks -= 2;
     }
 
-    void Write(Byte value, u32 Address, u32& ticks) {
-        Data[Address] = value;
+    void Write(Byte value, u32 Address, s32& ticks) {
+        Store(Address, value);
         ticks--;
     }
 };
@@ -49,18 +294,243 @@ char asciitolower(char in) {
     return in;
 }
 
-void toLowerCase(string& input) {
-    string res = "";
-    for (int i = 0; i < input.length(); i++) {
-        res += asciitolower(input[i]);
+void toLowerCase(char* input) {
+    for (; *input; input++) {
+        *input = asciitolower(*input);
+    }
+}
+
+// FNV-1a, used for save-state page checksums
+u32 Checksum(const Byte* data, u32 length) {
+    u32 hash = 2166136261u;
+    for (u32 i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Bump allocator for everything a job needs. Reserved once at startup and reset between jobs,
+// so loading and running a program never touches the heap.
+struct ARENA {
+    static constexpr size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+
+    Byte* Data = nullptr;
+    size_t Capacity = 0;
+    size_t Used = 0;
+
+    ~ARENA() {
+        free(Data);
+    }
+
+    bool Initialize(size_t capacity) {
+        free(Data);
+        Data = (Byte*)malloc(capacity);
+        Capacity = Data != nullptr ? capacity : 0;
+        Used = 0;
+        return Data != nullptr;
+    }
+
+    void* Allocate(size_t size) {
+        size_t Start = (Used + 7) & ~(size_t)7;
+        if (Start + size > Capacity) {
+            return nullptr;
+        }
+        Used = Start + size;
+        return Data + Start;
+    }
+
+    void Reset() {
+        Used = 0;
+    }
+};
+
+// Counts operator new calls so --check-allocations can prove a job stays off the C++ heap.
+// The operators stay out of line, inlined GCC pairs new expressions with malloc and free and warns.
+static atomic<u64> HeapAllocations(0);
+
+__attribute__((noinline)) void* operator new(size_t size) {
+    HeapAllocations.fetch_add(1, memory_order_relaxed);
+    void* block = malloc(size != 0 ? size : 1);
+    if (block == nullptr) {
+        throw bad_alloc();
     }
-    input = res;
+    return block;
+}
+
+__attribute__((noinline)) void operator delete(void* block) noexcept {
+    free(block);
+}
+
+__attribute__((noinline)) void operator delete(void* block, size_t) noexcept {
+    free(block);
+}
+
+u64 Nanoseconds() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ull + now.tv_nsec;
 }
 
-constexpr unsigned int str2int(const char* str, int h = 0) {
-    return !str[h] ? 5381 : (str2int(str, h + 1) * 33) ^ str[h];
+// Counters below have a single writer, so they are bumped with a plain load and store
+// instead of a locked read-modify-write
+void Bump(atomic<u64>& counter, u64 value = 1) {
+    counter.store(counter.load(memory_order_relaxed) + value, memory_order_relaxed);
 }
 
+// Log-linear histogram in the style of HDR histograms: 8 buckets per power of two, so any
+// recorded value is known to within 12.5%
+struct HISTOGRAM {
+    static constexpr u32 SUB_BITS = 3;
+    static constexpr u32 SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr u32 BUCKETS = 64 * SUB_BUCKETS;
+
+    atomic<u64> Counts[BUCKETS] = {};
+    atomic<u64> Sum{0};
+
+    static u32 Bucket(u64 value) {
+        if (value < SUB_BUCKETS) {
+            return value;
+        }
+        u32 exponent = 63 - __builtin_clzll(value);
+        u32 sub = (value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Smallest value that lands in bucket
+    static u64 Lower(u32 bucket) {
+        if (bucket < SUB_BUCKETS) {
+            return bucket;
+        }
+        u32 exponent = bucket / SUB_BUCKETS + SUB_BITS - 1;
+        return (u64)(SUB_BUCKETS + bucket % SUB_BUCKETS) << (exponent - SUB_BITS);
+    }
+
+    void Record(u64 value) {
+        Bump(Counts[Bucket(value)]);
+        Bump(Sum, value);
+    }
+};
+
+// One per thread, registered on first use and never freed so counts outlive their thread
+struct METRICS_SHARD {
+    atomic<u64> Instructions{0};
+    atomic<u64> Cycles{0};
+    atomic<u64> FusedInstructions{0};
+    atomic<u64> UnhandledOpcodes{0};
+    HISTOGRAM JobNanoseconds;
+    HISTOGRAM RestoreNanoseconds;
+    METRICS_SHARD* Next = nullptr;
+};
+
+struct METRICS {
+    mutex Lock;
+    METRICS_SHARD* Shards = nullptr;
+
+    METRICS_SHARD& Local() {
+        thread_local METRICS_SHARD* shard = nullptr;
+        if (shard == nullptr) {
+            shard = new METRICS_SHARD;
+            lock_guard<mutex> guard(Lock);
+            shard->Next = Shards;
+            Shards = shard;
+        }
+        return *shard;
+    }
+
+    u64 Total(atomic<u64> METRICS_SHARD::* counter) {
+        lock_guard<mutex> guard(Lock);
+        u64 total = 0;
+        for (METRICS_SHARD* shard = Shards; shard != nullptr; shard = shard->Next) {
+            total += (shard->*counter).load(memory_order_relaxed);
+        }
+        return total;
+    }
+
+    void Merge(HISTOGRAM METRICS_SHARD::* histogram, u64* Counts, u64& Sum) {
+        lock_guard<mutex> guard(Lock);
+        memset(Counts, 0, HISTOGRAM::BUCKETS * sizeof(u64));
+        Sum = 0;
+        for (METRICS_SHARD* shard = Shards; shard != nullptr; shard = shard->Next) {
+            for (u32 i = 0; i < HISTOGRAM::BUCKETS; i++) {
+                Counts[i] += (shard->*histogram).Counts[i].load(memory_order_relaxed);
+            }
+            Sum += (shard->*histogram).Sum.load(memory_order_relaxed);
+        }
+    }
+
+    static void WriteCounter(FILE* Output, const char* name, const char* help, u64 value) {
+        fprintf(Output, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name, value);
+    }
+
+    // Prometheus histogram in seconds with a bucket per power of two nanoseconds from 1us to
+    // about a minute, plus HDR precision quantiles as gauges
+    void WriteHistogram(FILE* Output, const char* name, const char* help, HISTOGRAM METRICS_SHARD::* histogram) {
+        u64 Counts[HISTOGRAM::BUCKETS];
+        u64 Sum;
+        Merge(histogram, Counts, Sum);
+
+        u64 Count = 0;
+        for (u32 i = 0; i < HISTOGRAM::BUCKETS; i++) {
+            Count += Counts[i];
+        }
+
+        fprintf(Output, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+        u64 Cumulative = 0;
+        u32 bucket = 0;
+        for (u32 power = 10; power <= 36; power++) {
+            while (bucket < HISTOGRAM::BUCKETS - 1 && HISTOGRAM::Lower(bucket + 1) <= (1ull << power)) {
+                Cumulative += Counts[bucket++];
+            }
+            fprintf(Output, "%s_bucket{le=\"%.9g\"} %llu\n", name, (double)(1ull << power) / 1e9, Cumulative);
+        }
+        fprintf(Output, "%s_bucket{le=\"+Inf\"} %llu\n", name, Count);
+        fprintf(Output, "%s_sum %.9g\n%s_count %llu\n", name, Sum / 1e9, name, Count);
+
+        static const double Quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        fprintf(Output, "# TYPE %s_quantile gauge\n", name);
+        for (double quantile : Quantiles) {
+            u64 Seen = 0;
+            u32 i = 0;
+            while (i < HISTOGRAM::BUCKETS - 1 && (Count == 0 || Seen + Counts[i] < quantile * Count)) {
+                Seen += Counts[i++];
+            }
+            double Value = Count == 0 ? 0 : HISTOGRAM::Lower(i + 1) / 1e9;
+            fprintf(Output, "%s_quantile{quantile=\"%g\"} %.9g\n", name, quantile, Value);
+        }
+    }
+
+    void Write(FILE* Output) {
+        WriteCounter(Output, "emulator_instructions_total", "Instructions executed.", Total(&METRICS_SHARD::Instructions));
+        WriteCounter(Output, "emulator_cycles_total", "Emulated cycles.", Total(&METRICS_SHARD::Cycles));
+        WriteCounter(Output, "emulator_fused_instructions_total", "Instructions run inside a superinstruction.", Total(&METRICS_SHARD::FusedInstructions));
+        WriteCounter(Output, "emulator_unhandled_opcodes_total", "Opcodes the CPU does not implement.", Total(&METRICS_SHARD::UnhandledOpcodes));
+        WriteHistogram(Output, "emulator_job_duration_seconds", "Wall time of a job.", &METRICS_SHARD::JobNanoseconds);
+        WriteHistogram(Output, "emulator_snapshot_restore_seconds", "Wall time of a save state restore.", &METRICS_SHARD::RestoreNanoseconds);
+    }
+};
+
+static METRICS Metrics;
+
+// Bus policies for CPU6502::Execute. Both run the same opcode handlers; the policy decides
+// at compile time what a bus cycle costs.
+
+// Instruction stepped, bus cycles are only counted
+struct FAST_BUS {
+    static void Cycle(MEMORY&, Word, Byte, Byte) {}
+};
+
+// Cycle exact, every bus cycle including dummy accesses reaches the attached listener
+struct CYCLE_BUS {
+    static void Cycle(MEMORY& memory, Word address, Byte data, Byte kind) {
+        if (memory.Listener != nullptr) {
+            memory.Listener(memory.ListenerContext, address, data, kind);
+        }
+    }
+};
+
+struct NMOS;
+
 struct CPU6502 {
 
     Word program_counter;
@@ -76,6 +546,30 @@ struct CPU6502 {
     Byte overflow : 1; // Overflow flag
     Byte negative : 1; // Negative flag
 
+    u64 cycles; // Ticks executed since Reset
+    Word code_floor; // Execution stops once the program counter drops below this
+
+    // Why the last Execute returned
+    Byte stop_reason;
+    bool report_unhandled; // Print opcodes the CPU does not implement
+
+    static constexpr Byte
+        STOP_BUDGET = 0, // Tick budget used up
+        STOP_PC_RANGE = 1, // Program counter left the program area
+        STOP_BREAKPOINT = 2, // Program counter reached a breakpoint
+        STOP_WATCHPOINT = 3; // A watched address was accessed, see MEMORY::WatchAddress
+
+    // Processor status bit positions (NV-BDIZC)
+    static constexpr Byte
+        FLAG_CARRY = 0b00000001,
+        FLAG_ZERO = 0b00000010,
+        FLAG_INTERRUPT = 0b00000100,
+        FLAG_DECIMAL = 0b00001000,
+        FLAG_BREAK = 0b00010000,
+        FLAG_UNUSED = 0b00100000,
+        FLAG_OVERFLOW = 0b01000000,
+        FLAG_NEGATIVE = 0b10000000;
+
     // Instructions
     static constexpr Byte
 
@@ -97,6 +591,8 @@ struct CPU6502 {
         // Store A register
         INS_STA_ZP = 0x85, // 3 ticks
         INS_STA_ZPX = 0x95, // 4 ticks
+        INS_STA_ABS = 0x8D, // 4 ticks
+        INS_STA_ABSX = 0x9D, // 5 ticks
 
         // Store X register
         INS_STX_ZP = 0x86, // 3 ticks
@@ -175,11 +671,11 @@ struct CPU6502 {
         INS_AND_ZPX = 0x35, // 4 ticks
 
         // Decrement Memory
-        INS_DEC_ZP = 0xC6, // 4 ticks
-        INS_DEC_ZPX = 0xD6, // 5 ticks
+        INS_DEC_ZP = 0xC6, // 5 ticks
+        INS_DEC_ZPX = 0xD6, // 6 ticks
 
         // Increment Memory
-        INS_INC_ZP = 0xE6, // 4 ticks
+        INS_INC_ZP = 0xE6, // 5 ticks
         INS_INC_ZPX = 0xF6, // 6 ticks
 
         // Arithmetic Shift Left
@@ -202,242 +698,82 @@ struct CPU6502 {
         INS_JSR = 0x20; // 6 ticks
 
 
-    void interpretInstruction(string instruction, Word& counter, MEMORY& memory, u32& ticks) {
-        Byte ins;
-
-        if (instruction.compare("ldaim") == 0) {
-            ins = INS_LDA_IM;
-            ticks += 2;
-        }
-        else if (instruction.compare("ldazp") == 0) {
-            ins = INS_LDA_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("ldazpx") == 0) {
-            ins = INS_LDA_ZPX;
-            ticks += 4;
-        }
-        else if (instruction.compare("ldxim") == 0) {
-            ins = INS_LDX_IM;
-            ticks += 2;
-        }
-        else if (instruction.compare("ldxzp") == 0) {
-            ins = INS_LDX_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("ldxzpy") == 0) {
-            ins = INS_LDX_ZPY;
-            ticks += 4;
-        }
-        else if (instruction.compare("ldyim") == 0) {
-            ins = INS_LDY_IM;
-            ticks += 2;
-        }
-        else if (instruction.compare("ldyzp") == 0) {
-            ins = INS_LDY_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("ldyzpx") == 0) {
-            ins = INS_LDY_ZPX;
-            ticks += 4;
-        }
-
-        else if (instruction.compare("sta") == 0) {
-            ins = INS_STA_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("stax") == 0) {
-            ins = INS_STA_ZPX;
-            ticks += 4;
-        }
-        else if (instruction.compare("stx") == 0) {
-            ins = INS_STX_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("stxy") == 0) {
-            ins = INS_STX_ZPY;
-            ticks += 4;
-        }
-        else if (instruction.compare("sty") == 0) {
-            ins = INS_STY_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("styx") == 0) {
-            ins = INS_STY_ZPX;
-            ticks += 4;
-        }
-
-        else if (instruction.compare("tax") == 0) {
-            ins = INS_TAX;
-            ticks += 2;
-        }
-        else if (instruction.compare("tay") == 0) {
-            ins = INS_TAY;
-            ticks += 2;
-        }
-        else if (instruction.compare("txa") == 0) {
-            ins = INS_TXA;
-            ticks += 2;
-        }
-        else if (instruction.compare("tya") == 0) {
-            ins = INS_TYA;
-            ticks += 2;
-        }
-        else if (instruction.compare("tsx") == 0) {
-            ins = INS_TSX;
-            ticks += 2;
-        }
-        else if (instruction.compare("txs") == 0) {
-            ins = INS_TXS;
-            ticks += 2;
-        }
-
-        else if (instruction.compare("pha") == 0) {
-            ins = INS_PHA;
-            ticks += 3;
-        }
-        else if (instruction.compare("pla") == 0) {
-            ins = INS_PLA;
-            ticks += 4;
-        }
-
-        else if (instruction.compare("inx") == 0) {
-            ins = INS_INX;
-            ticks += 2;
-        }
-        else if (instruction.compare("iny") == 0) {
-            ins = INS_INY;
-            ticks += 2;
-        }
-        else if (instruction.compare("dex") == 0) {
-            ins = INS_DEX;
-            ticks += 2;
-        }
-        else if (instruction.compare("dey") == 0) {
-            ins = INS_DEY;
-            ticks += 2;
-        }
-
-        else if (instruction.compare("nop") == 0) {
-            ins = INS_NOP;
-            ticks += 2;
-        }
-
-        else if (instruction.compare("rts") == 0) {
-            ins = INS_RTS;
-            ticks += 6;
-        }
-
-        else if (instruction.compare("sec") == 0) {
-            ins = INS_SEC;
-            ticks += 2;
-        }
-        else if (instruction.compare("sed") == 0) {
-            ins = INS_SED;
-            ticks += 2;
-        }
-        else if (instruction.compare("sei") == 0) {
-            ins = INS_SEI;
-            ticks += 2;
-        }
-        else if (instruction.compare("clc") == 0) {
-            ins = INS_CLC;
-            ticks += 2;
-        }
-        else if (instruction.compare("cld") == 0) {
-            ins = INS_CLD;
-            ticks += 2;
-        }
-        else if (instruction.compare("cli") == 0) {
-            ins = INS_CLI;
-            ticks += 2;
-        }
-        else if (instruction.compare("clv") == 0) {
-            ins = INS_CLV;
-            ticks += 2;
-        }
-
-        else if (instruction.compare("and") == 0) {
-            ins = INS_AND_IM;
-            ticks += 2;
-        }
-        else if (instruction.compare("andzp") == 0) {
-            ins = INS_AND_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("andzpx") == 0) {
-            ins = INS_AND_ZPX;
-            ticks += 4;
-        }
-
-        else if (instruction.compare("dec") == 0) {
-            ins = INS_DEC_ZP;
-            ticks += 4;
-        }
-        else if (instruction.compare("decx") == 0) {
-            ins = INS_DEC_ZPX;
-            ticks += 5;
-        }
-        else if (instruction.compare("inc") == 0) {
-            ins = INS_INC_ZP;
-            ticks += 4;
-        }
-        else if (instruction.compare("incx") == 0) {
-            ins = INS_INC_ZPX;
-            ticks += 5;
-        }
-
-        else if (instruction.compare("asl") == 0) {
-            ins = INS_ASL_ACC;
-            ticks += 2;
-        }
-        else if (instruction.compare("aslzp") == 0) {
-            ins = INS_ASL_ZP;
-            ticks += 5;
-        }
-        else if (instruction.compare("aslzpx") == 0) {
-            ins = INS_ASL_ZPX;
-            ticks += 6;
-        }
-
-        else if (instruction.compare("lsr") == 0) {
-            ins = INS_LSR_ACC;
-            ticks += 2;
-        }
-        else if (instruction.compare("lsrzp") == 0) {
-            ins = INS_LSR_ZP;
-            ticks += 5;
-        }
-        else if (instruction.compare("lsrzpx") == 0) {
-            ins = INS_LSR_ZPX;
-            ticks += 6;
-        }
-
-        else if (instruction.compare("or") == 0) {
-            ins = INS_ORA_IM;
-            ticks += 2;
-        }
-        else if (instruction.compare("orzp") == 0) {
-            ins = INS_ORA_ZP;
-            ticks += 3;
-        }
-        else if (instruction.compare("orzpx") == 0) {
-            ins = INS_ORA_ZPX;
-            ticks += 4;
-        }
-
-        else if (instruction.compare("jmp") == 0) {
-            ins = INS_JMP;
-            ticks += 3;
-        }
-        else if (instruction.compare("jsr") == 0) {
-            ins = INS_JSR;
-            ticks += 4;
-        }
-        else {
-            ins = INS_NOP;
-            ticks += 2;
+    void interpretInstruction(const char* instruction, Word& counter, MEMORY& memory, s32& ticks) {
+        struct WORD {
+            const char* Name;
+            Byte Opcode;
+            s32 Cycles;
+        };
+        static const WORD Words[] = {
+            { "ldaim",   INS_LDA_IM,   2 },
+            { "ldazp",   INS_LDA_ZP,   3 },
+            { "ldazpx",  INS_LDA_ZPX,  4 },
+            { "ldxim",   INS_LDX_IM,   2 },
+            { "ldxzp",   INS_LDX_ZP,   3 },
+            { "ldxzpy",  INS_LDX_ZPY,  4 },
+            { "ldyim",   INS_LDY_IM,   2 },
+            { "ldyzp",   INS_LDY_ZP,   3 },
+            { "ldyzpx",  INS_LDY_ZPX,  4 },
+            { "sta",     INS_STA_ZP,   3 },
+            { "stax",    INS_STA_ZPX,  4 },
+            { "staabs",  INS_STA_ABS,  4 },
+            { "staabsx", INS_STA_ABSX, 5 },
+            { "stx",     INS_STX_ZP,   3 },
+            { "stxy",    INS_STX_ZPY,  4 },
+            { "sty",     INS_STY_ZP,   3 },
+            { "styx",    INS_STY_ZPX,  4 },
+            { "tax",     INS_TAX,      2 },
+            { "tay",     INS_TAY,      2 },
+            { "txa",     INS_TXA,      2 },
+            { "tya",     INS_TYA,      2 },
+            { "tsx",     INS_TSX,      2 },
+            { "txs",     INS_TXS,      2 },
+            { "pha",     INS_PHA,      3 },
+            { "pla",     INS_PLA,      4 },
+            { "inx",     INS_INX,      2 },
+            { "iny",     INS_INY,      2 },
+            { "dex",     INS_DEX,      2 },
+            { "dey",     INS_DEY,      2 },
+            { "nop",     INS_NOP,      2 },
+            { "rts",     INS_RTS,      6 },
+            { "sec",     INS_SEC,      2 },
+            { "sed",     INS_SED,      2 },
+            { "sei",     INS_SEI,      2 },
+            { "clc",     INS_CLC,      2 },
+            { "cld",     INS_CLD,      2 },
+            { "cli",     INS_CLI,      2 },
+            { "clv",     INS_CLV,      2 },
+            { "and",     INS_AND_IM,   2 },
+            { "andzp",   INS_AND_ZP,   3 },
+            { "andzpx",  INS_AND_ZPX,  4 },
+            { "dec",     INS_DEC_ZP,   5 },
+            { "decx",    INS_DEC_ZPX,  6 },
+            { "inc",     INS_INC_ZP,   5 },
+            { "incx",    INS_INC_ZPX,  6 },
+            { "asl",     INS_ASL_ACC,  2 },
+            { "aslzp",   INS_ASL_ZP,   5 },
+            { "aslzpx",  INS_ASL_ZPX,  6 },
+            { "lsr",     INS_LSR_ACC,  2 },
+            { "lsrzp",   INS_LSR_ZP,   5 },
+            { "lsrzpx",  INS_LSR_ZPX,  6 },
+            { "or",      INS_ORA_IM,   2 },
+            { "orzp",    INS_ORA_ZP,   3 },
+            { "orzpx",   INS_ORA_ZPX,  4 },
+            { "jmp",     INS_JMP,      3 },
+            { "jsr",     INS_JSR,      6 },
+        };
+
+        // Anything that is not one of the words stays a NOP
+        Byte ins = INS_NOP;
+        s32 cost = 2;
+        for (const WORD& word : Words) {
+            if (strcmp(instruction, word.Name) == 0) {
+                ins = word.Opcode;
+                cost = word.Cycles;
+                break;
+            }
         }
+        ticks += cost;
 
         memory[counter] = ins;
         counter++;
@@ -453,31 +789,104 @@ struct CPU6502 {
         stack_pointer = 0x1000;
         a = x = y = 0;
         carry = zero = interrupt = decimal = Break = overflow = negative = 0;
+        cycles = 0;
+        code_floor = 0xFF00;
+        report_unhandled = true;
         memory.Initialize();
     }
 
-    Byte Fetch(u32& ticks, MEMORY& memory) {
+    Byte PackFlags() const {
+        return (carry ? FLAG_CARRY : 0)
+            | (zero ? FLAG_ZERO : 0)
+            | (interrupt ? FLAG_INTERRUPT : 0)
+            | (decimal ? FLAG_DECIMAL : 0)
+            | (Break ? FLAG_BREAK : 0)
+            | FLAG_UNUSED
+            | (overflow ? FLAG_OVERFLOW : 0)
+            | (negative ? FLAG_NEGATIVE : 0);
+    }
+
+    void UnpackFlags(Byte flags) {
+        carry = (flags & FLAG_CARRY) > 0;
+        zero = (flags & FLAG_ZERO) > 0;
+        interrupt = (flags & FLAG_INTERRUPT) > 0;
+        decimal = (flags & FLAG_DECIMAL) > 0;
+        Break = (flags & FLAG_BREAK) > 0;
+        overflow = (flags & FLAG_OVERFLOW) > 0;
+        negative = (flags & FLAG_NEGATIVE) > 0;
+    }
+
+    // Every tick below is one bus cycle, reported through Bus
+    template <typename Bus = FAST_BUS>
+    Byte Fetch(s32& ticks, MEMORY& memory, Byte kind = MEMORY::BUS_READ) {
         Byte instruction = memory[program_counter];
+        Bus::Cycle(memory, program_counter, instruction, kind);
         program_counter++;
         ticks--;
         return instruction;
     }
 
-    Byte Read(u32& ticks, Byte address, MEMORY& memory) {
-        Byte Data = memory[address];
+    template <typename Bus = FAST_BUS>
+    Byte FetchOpcode(s32& ticks, MEMORY& memory) {
+        return Fetch<Bus>(ticks, memory, MEMORY::BUS_OPCODE);
+    }
+
+    template <typename Bus = FAST_BUS>
+    Byte Read(s32& ticks, Word address, MEMORY& memory) {
+        Byte Data = memory.Read(address);
+        Bus::Cycle(memory, address, Data, MEMORY::BUS_READ);
         ticks--;
         return Data;
     }
 
-    Word FetchWord(u32& ticks, MEMORY& memory) {
-        Word Data = memory[program_counter];
-        program_counter++;
+    template <typename Bus = FAST_BUS>
+    Word FetchWord(s32& ticks, MEMORY& memory) {
+        Word Data = Fetch<Bus>(ticks, memory);
+        Data |= (Fetch<Bus>(ticks, memory) << 8);
+        return Data;
+    }
 
-        Data |= (memory[program_counter] << 8);
-        program_counter++;
+    template <typename Bus = FAST_BUS>
+    void Write(s32& ticks, Byte value, Word address, MEMORY& memory) {
+        Bus::Cycle(memory, address, value, MEMORY::BUS_WRITE);
+        memory.Write(value, address, ticks);
+    }
 
-        ticks -= 2;
-        return Data;
+    template <typename Bus = FAST_BUS>
+    void WriteWord(s32& ticks, Word value, Word address, MEMORY& memory) {
+        Bus::Cycle(memory, address, value & 0xFF, MEMORY::BUS_WRITE);
+        Bus::Cycle(memory, (address + 1) % MEMORY::MAX_MEMORY, value >> 8, MEMORY::BUS_WRITE);
+        memory.WriteWord(value, address, ticks);
+    }
+
+    // Internal cycle, on which the chip reads an address and throws the value away
+    template <typename Bus = FAST_BUS>
+    void Idle(s32& ticks, Word address, MEMORY& memory) {
+        Bus::Cycle(memory, address, memory[address], MEMORY::BUS_DUMMY_READ);
+        ticks--;
+    }
+
+    // Read-modify-write instructions store the unmodified value once before the result
+    template <typename Bus = FAST_BUS>
+    void DummyWrite(s32& ticks, Byte value, Word address, MEMORY& memory) {
+        Bus::Cycle(memory, address, value, MEMORY::BUS_DUMMY_WRITE);
+        ticks--;
+    }
+
+    // Cycle between reading and writing back a read-modify-write operand, which the variant decides
+    template <typename Bus, typename Variant>
+    void Modify(s32& ticks, Byte value, Word address, MEMORY& memory) {
+        Variant::template Modify<Bus>(*this, ticks, value, address, memory);
+    }
+
+    // Superinstructions: a handler may run the instruction that follows it in the same dispatch.
+    // It only does so when the loop would have run it anyway, so timing and stops are unchanged.
+    bool CanFuse(Byte next, s32 ticks, MEMORY& memory) const {
+        return ticks > 0
+            && program_counter >= code_floor
+            && memory[program_counter] == next
+            && !memory.WatchHit
+            && !memory.IsBreakpoint(program_counter);
     }
 
     void LDASetFlags() {
@@ -495,446 +904,3498 @@ struct CPU6502 {
         negative = (y & 0b10000000) > 0;
     }
 
-    void Execute(u32 ticks, MEMORY& memory) {
+    // Returns the remaining ticks, which is negative when the last instruction overran the budget
+    template <typename Bus = FAST_BUS, typename Variant = NMOS>
+    s32 Execute(s32 ticks, MEMORY& memory) {
+        s32 budget = ticks;
+        u64 executed = 0, fused = 0, unhandled = 0;
+        stop_reason = STOP_BUDGET;
+        memory.WatchHit = false;
         while (ticks > 0) {
-            Byte instruction = Fetch(ticks, memory);
+            Byte instruction = FetchOpcode<Bus>(ticks, memory);
+            executed++;
             switch (instruction) {
             case INS_LDA_IM: {
-                Byte value = Fetch(ticks, memory);
+                Byte value = Fetch<Bus>(ticks, memory);
                 a = value;
                 LDASetFlags();
+                // LDA # / STA zp
+                if (CanFuse(INS_STA_ZP, ticks, memory)) {
+                    FetchOpcode<Bus>(ticks, memory);
+                    fused++;
+                    Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                    Write<Bus>(ticks, a, ZeroPageAddress, memory);
+                }
             } break;
 
             case INS_LDA_ZP: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
-                a = Read(ticks, ZeroPageAddress, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                a = Read<Bus>(ticks, ZeroPageAddress, memory);
                 LDASetFlags();
+                // LDA zp / STA zp
+                if (CanFuse(INS_STA_ZP, ticks, memory)) {
+                    FetchOpcode<Bus>(ticks, memory);
+                    fused++;
+                    ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                    Write<Bus>(ticks, a, ZeroPageAddress, memory);
+                }
             } break;
 
             case INS_LDA_ZPX: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPageAddress, memory);
                 ZeroPageAddress += x;
-                ticks--;
-                a = Read(ticks, ZeroPageAddress, memory);
+                a = Read<Bus>(ticks, ZeroPageAddress, memory);
                 LDASetFlags();
             } break;
 
             case INS_LDX_IM: {
-                Byte value = Fetch(ticks, memory);
+                Byte value = Fetch<Bus>(ticks, memory);
                 x = value;
                 LDXSetFlags();
             } break;
 
             case INS_LDX_ZP: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
-                x = Read(ticks, ZeroPageAddress, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                x = Read<Bus>(ticks, ZeroPageAddress, memory);
                 LDXSetFlags();
             } break;
 
             case INS_LDX_ZPY: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPageAddress, memory);
                 ZeroPageAddress += y;
-                ticks--;
-                x = Read(ticks, ZeroPageAddress, memory);
+                x = Read<Bus>(ticks, ZeroPageAddress, memory);
                 LDXSetFlags();
             } break;
 
             case INS_LDY_IM: {
-                Byte value = Fetch(ticks, memory);
+                Byte value = Fetch<Bus>(ticks, memory);
                 y = value;
                 LDYSetFlags();
             } break;
 
             case INS_LDY_ZP: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
-                y = Read(ticks, ZeroPageAddress, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                y = Read<Bus>(ticks, ZeroPageAddress, memory);
                 LDYSetFlags();
             } break;
 
             case INS_LDY_ZPX: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPageAddress, memory);
                 ZeroPageAddress += x;
-                ticks--;
-                y = Read(ticks, ZeroPageAddress, memory);
+                y = Read<Bus>(ticks, ZeroPageAddress, memory);
             } break;
 
             case INS_STA_ZP: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
-                memory.Write(a, ZeroPageAddress, ticks);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Write<Bus>(ticks, a, ZeroPageAddress, memory);
             } break;
 
             case INS_STA_ZPX: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPageAddress, memory);
                 ZeroPageAddress += x;
-                memory.Write(a, ZeroPageAddress, ticks);
+                Write<Bus>(ticks, a, ZeroPageAddress, memory);
+            } break;
+
+            case INS_STA_ABS: {
+                Word Address = FetchWord<Bus>(ticks, memory);
+                Write<Bus>(ticks, a, Address, memory);
+            } break;
+
+            case INS_STA_ABSX: {
+                Word Address = FetchWord<Bus>(ticks, memory);
+                // The chip reads before fixing up the high byte of the indexed address
+                Idle<Bus>(ticks, (Address & 0xFF00) | ((Address + x) & 0xFF), memory);
+                Address += x;
+                Write<Bus>(ticks, a, Address, memory);
             } break;
 
             case INS_STX_ZP: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
-                memory.Write(x, ZeroPageAddress, ticks);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Write<Bus>(ticks, x, ZeroPageAddress, memory);
             } break;
 
             case INS_STX_ZPY: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPageAddress, memory);
                 ZeroPageAddress += y;
-                memory.Write(x, ZeroPageAddress, ticks);
+                Write<Bus>(ticks, x, ZeroPageAddress, memory);
             } break;
 
             case INS_STY_ZP: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
-                memory.Write(y, ZeroPageAddress, ticks);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Write<Bus>(ticks, y, ZeroPageAddress, memory);
             } break;
 
             case INS_STY_ZPX: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPageAddress, memory);
                 ZeroPageAddress += x;
-                memory.Write(y, ZeroPageAddress, ticks);
-            }
+                Write<Bus>(ticks, y, ZeroPageAddress, memory);
+            } break;
 
             case INS_TSX: {
                 x = stack_pointer;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDXSetFlags();
             } break;
 
             case INS_TAX: {
                 x = a;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDXSetFlags();
             } break;
 
             case INS_TAY: {
                 y = a;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDYSetFlags();
             } break;
 
             case INS_TXA: {
                 a = x;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDASetFlags();
             } break;
 
             case INS_TXS: {
                 stack_pointer = x;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_TYA: {
                 a = y;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDASetFlags();
             } break;
 
             case INS_PHA: {
-                memory.WriteWord(a << 8, stack_pointer, ticks);
+                WriteWord<Bus>(ticks, a << 8, stack_pointer, memory);
                 stack_pointer++;
             } break;
 
             case INS_PLA: {
-                a = memory[stack_pointer];
-                ticks--;
-                memory[stack_pointer] = 0;
-                ticks--;
+                a = Read<Bus>(ticks, stack_pointer, memory);
+                Write<Bus>(ticks, 0, stack_pointer, memory);
                 stack_pointer--;
                 LDASetFlags();
             } break;
 
             case INS_INX: {
                 x++;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
+                // INX / INX
+                if (CanFuse(INS_INX, ticks, memory)) {
+                    FetchOpcode<Bus>(ticks, memory);
+                    fused++;
+                    x++;
+                    Idle<Bus>(ticks, program_counter, memory);
+                }
                 LDXSetFlags();
             } break;
 
             case INS_INY: {
                 y++;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDYSetFlags();
             } break;
 
             case INS_NOP: {
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_SEC: {
                 carry = 1;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_SED: {
                 decimal = 1;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_SEI: {
                 interrupt = 1;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_CLC: {
                 carry = 0;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_CLD: {
                 decimal = 0;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_CLI: {
                 interrupt = 0;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_CLV: {
                 overflow = 0;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
             } break;
 
             case INS_DEX: {
                 x--;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
+                // DEX / DEX
+                if (CanFuse(INS_DEX, ticks, memory)) {
+                    FetchOpcode<Bus>(ticks, memory);
+                    fused++;
+                    x--;
+                    Idle<Bus>(ticks, program_counter, memory);
+                }
                 LDXSetFlags();
             } break;
 
             case INS_DEY: {
                 y--;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDYSetFlags();
             } break;
 
             case INS_AND_IM: {
-                Byte value = Fetch(ticks, memory);
+                Byte value = Fetch<Bus>(ticks, memory);
                 a = a & value;
                 LDASetFlags();
             } break;
 
             case INS_AND_ZP: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
-                Byte value = Read(ticks, ZeroPageAddress, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Byte value = Read<Bus>(ticks, ZeroPageAddress, memory);
                 a = a & value;
                 LDASetFlags();
             } break;
 
             case INS_AND_ZPX: {
-                Byte ZeroPageAddress = Fetch(ticks, memory);
+                Byte ZeroPageAddress = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPageAddress, memory);
                 ZeroPageAddress += x;
-                ticks--;
-                Byte value = Read(ticks, ZeroPageAddress, memory);
+                Byte value = Read<Bus>(ticks, ZeroPageAddress, memory);
                 a = a & value;
                 LDASetFlags();
             } break;
 
             case INS_DEC_ZP: {
-                Byte ZeroPage = Fetch(ticks, memory);
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
                 value--;
-                memory.Write(value, ZeroPage, ticks);
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 zero = (value == 0);
                 negative = (value & 0b10000000) > 0;
             } break;
 
             case INS_DEC_ZPX: {
-                Byte ZeroPage = Fetch(ticks, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPage, memory);
                 ZeroPage += x;
-                ticks--;
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
                 value--;
-                memory.Write(value, ZeroPage, ticks);
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 zero = (value == 0);
                 negative = (value & 0b10000000) > 0;
             } break;
 
             case INS_INC_ZP: {
-                Byte ZeroPage = Fetch(ticks, memory);
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
                 value++;
-                memory.Write(value, ZeroPage, ticks);
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 zero = (value == 0);
                 negative = (value & 0b10000000) > 0;
             } break;
 
             case INS_INC_ZPX: {
-                Byte ZeroPage = Fetch(ticks, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPage, memory);
                 ZeroPage += x;
-                ticks--;
-                Byte value = Read(ticks, ZeroPage, memory);
-                value--;
-                memory.Write(value, ZeroPage, ticks);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
+                value++;
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 zero = (value == 0);
                 negative = (value & 0b10000000) > 0;
             } break;
 
             case INS_ASL_ACC: {
                 a = a << 1;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDASetFlags();
             } break;
 
             case INS_ASL_ZP: {
-                Byte ZeroPage = Fetch(ticks, memory);
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
                 value = value << 1;
-                ticks--;
-                memory.Write(value, ZeroPage, ticks);
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 carry = negative = (value & 0b10000000) > 0;
                 zero = (value == 0);
             } break;
 
             case INS_ASL_ZPX: {
-                Byte ZeroPage = Fetch(ticks, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPage, memory);
                 ZeroPage += x;
-                ticks--;
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
                 value = value << 1;
-                ticks--;
-                memory.Write(value, ZeroPage, ticks);
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 carry = negative = (value & 0b10000000) > 0;
                 zero = (value == 0);
             } break;
 
             case INS_LSR_ACC: {
                 a = a >> 1;
-                ticks--;
+                Idle<Bus>(ticks, program_counter, memory);
                 LDASetFlags();
             } break;
 
             case INS_LSR_ZP: {
-                Byte ZeroPage = Fetch(ticks, memory);
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
                 value = value >> 1;
-                ticks--;
-                memory.Write(value, ZeroPage, ticks);
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 carry = negative = (value & 0b10000000) > 0;
                 zero = (value == 0);
             } break;
 
             case INS_LSR_ZPX: {
-                Byte ZeroPage = Fetch(ticks, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPage, memory);
                 ZeroPage += x;
-                ticks--;
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
+                Modify<Bus, Variant>(ticks, value, ZeroPage, memory);
                 value = value >> 1;
-                ticks--;
-                memory.Write(value, ZeroPage, ticks);
+                Write<Bus>(ticks, value, ZeroPage, memory);
                 carry = negative = (value & 0b10000000) > 0;
                 zero = (value == 0);
             } break;
 
             case INS_ORA_IM: {
-                Byte value = Fetch(ticks, memory);
+                Byte value = Fetch<Bus>(ticks, memory);
                 a |= value;
                 LDASetFlags();
             } break;
 
             case INS_ORA_ZP: {
-                Byte ZeroPage = Fetch(ticks, memory);
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
                 a |= value;
                 LDASetFlags();
             } break;
 
             case INS_ORA_ZPX: {
-                Byte ZeroPage = Fetch(ticks, memory);
+                Byte ZeroPage = Fetch<Bus>(ticks, memory);
+                Idle<Bus>(ticks, ZeroPage, memory);
                 ZeroPage += x;
-                ticks--;
-                Byte value = Read(ticks, ZeroPage, memory);
+                Byte value = Read<Bus>(ticks, ZeroPage, memory);
                 a |= value;
                 LDASetFlags();
             } break;
 
             case INS_JMP: {
-                Word newAddress = FetchWord(ticks, memory);
+                Word newAddress = FetchWord<Bus>(ticks, memory);
                 program_counter = newAddress;
             } break;
 
             case INS_RTS: {
                 program_counter = stack_pointer;
-                Word NewProgramCounter = FetchWord(ticks, memory);
-                memory.WriteWord(0, stack_pointer, ticks);
+                Word NewProgramCounter = FetchWord<Bus>(ticks, memory);
+                WriteWord<Bus>(ticks, 0, stack_pointer, memory);
                 program_counter = NewProgramCounter;
-                ticks--;
+                Idle<Bus>(ticks, stack_pointer, memory);
                 stack_pointer -= 2;
             } break;
 
             case INS_JSR: {
-                Word SubRoutineAddress = FetchWord(ticks, memory);
-                memory.WriteWord(program_counter - 1, stack_pointer, ticks);
+                Word SubRoutineAddress = FetchWord<Bus>(ticks, memory);
+                Idle<Bus>(ticks, stack_pointer, memory);
+                WriteWord<Bus>(ticks, program_counter - 1, stack_pointer, memory);
                 stack_pointer++;
                 program_counter = SubRoutineAddress;
             } break;
 
             default: {
-                printf("Instruction not handled %d\n", instruction);
+                if (!Variant::template Execute<Bus>(*this, instruction, ticks, memory)) {
+                    unhandled++;
+                    if (report_unhandled) {
+                        printf("Instruction not handled %d\n", instruction);
+                    }
+                }
             } break;
             }
-            if (program_counter < 0xFF00) {
+            if (program_counter < code_floor) {
+                stop_reason = STOP_PC_RANGE;
+                break;
+            }
+            if (memory.WatchHit) {
+                stop_reason = STOP_WATCHPOINT;
+                break;
+            }
+            if (memory.IsBreakpoint(program_counter)) {
+                stop_reason = STOP_BREAKPOINT;
                 break;
             }
         }
+        cycles += budget - ticks;
+
+        METRICS_SHARD& shard = Metrics.Local();
+        Bump(shard.Instructions, executed + fused);
+        Bump(shard.FusedInstructions, fused);
+        Bump(shard.Cycles, budget - ticks);
+        if (unhandled > 0) {
+            Bump(shard.UnhandledOpcodes, unhandled);
+        }
+        return ticks;
     }
 
-    void replace(char v, char c, string& str) {
-        size_t index = str.find_first_of(v);
-        // str.replace(index, 1, c);
+    static bool IsSpace(char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
     }
 
-    u32 splitByNewLine(string sentence, MEMORY& memory) {
-        stringstream ss;
-        string line;
-
+    // Tokenizes the program text in place, so loading never copies it
+    s32 splitByNewLine(char* text, MEMORY& memory) {
         Word counter = program_counter;
-        u32 ticks = 0;
+        s32 ticks = 0;
 
-        ss << sentence;
+        while (true) {
+            while (IsSpace(*text)) {
+                text++;
+            }
+            if (*text == '\0') {
+                break;
+            }
 
-        int16_t found;
-        string temp;
-        while (!ss.eof()) {
-            ss >> temp;
+            char* token = text;
+            while (*text != '\0' && !IsSpace(*text)) {
+                text++;
+            }
+            if (*text != '\0') {
+                *text++ = '\0';
+            }
 
             if (counter < program_counter) {
-                cout << "Program size is too big. Exit";
+                printf("Program size is too big. Exit");
                 exit(3);
             }
 
-            if (istringstream(temp) >> found)
-                InterpretNumbers(found, counter, memory);
+            char* digits = (token[0] == '-' || token[0] == '+') ? token + 1 : token;
+            if (*digits >= '0' && *digits <= '9')
+                InterpretNumbers(strtol(token, nullptr, 10), counter, memory);
             else {
-                interpretInstruction(temp, counter, memory, ticks);
+                interpretInstruction(token, counter, memory, ticks);
             }
         }
         return ticks;
     }
 
-    string ReadFileInstructions(string FileName) {
-        string TextOfInstructions;
-        string Output;
+    // Returns the NUL terminated file contents allocated from arena, or nullptr
+    char* ReadFileInstructions(const char* FileName, ARENA& arena) {
+        int InstructionFile = open(FileName, O_RDONLY);
+        if (InstructionFile < 0) {
+            return nullptr;
+        }
 
-        ifstream InstructionFile(FileName);
+        struct stat info;
+        char* Output = nullptr;
+        if (fstat(InstructionFile, &info) == 0) {
+            Output = (char*)arena.Allocate(info.st_size + 1);
+        }
 
-        while (getline(InstructionFile, TextOfInstructions)) {
-            Output += "\n" + TextOfInstructions;
+        size_t Length = 0;
+        while (Output != nullptr && Length < (size_t)info.st_size) {
+            ssize_t count = read(InstructionFile, Output + Length, info.st_size - Length);
+            if (count <= 0) {
+                break;
+            }
+            Length += count;
+        }
+        if (Output != nullptr) {
+            Output[Length] = '\0';
         }
 
-        InstructionFile.close();
+        close(InstructionFile);
 
         return Output;
     }
 };
 
-int main() {
-    MEMORY memory;
-    CPU6502 cpu;
-    cpu.Reset(memory);
+// CPU variants for CPU6502::Execute. The dispatch switch hands every opcode the documented
+// NMOS set does not define to the variant, so each engine is compiled with only its own
+// instructions and the variant is never checked while running.
+
+// Documented NMOS 6502
+struct NMOS {
+    template <typename Bus>
+    static bool Execute(CPU6502&, Byte, s32&, MEMORY&) {
+        return false;
+    }
+
+    template <typename Bus>
+    static void Modify(CPU6502& cpu, s32& ticks, Byte value, Word address, MEMORY& memory) {
+        cpu.DummyWrite<Bus>(ticks, value, address, memory);
+    }
+};
+
+// NMOS 6502 with the stable undocumented opcodes
+struct NMOS_UNDOCUMENTED : NMOS {
+    static constexpr Byte
+
+        // Load A and X register
+        INS_LAX_ZP = 0xA7, // 3 ticks
+        INS_LAX_ZPY = 0xB7, // 4 ticks
+        INS_LAX_ABS = 0xAF, // 4 ticks
+
+        // Store A AND X
+        INS_SAX_ZP = 0x87, // 3 ticks
+        INS_SAX_ZPY = 0x97, // 4 ticks
+        INS_SAX_ABS = 0x8F, // 4 ticks
+
+        // Decrement Memory and Compare with A
+        INS_DCP_ZP = 0xC7, // 5 ticks
+        INS_DCP_ZPX = 0xD7, // 6 ticks
+
+        // Arithmetic Shift Left Memory and OR into A
+        INS_SLO_ZP = 0x07, // 5 ticks
+        INS_SLO_ZPX = 0x17, // 6 ticks
+
+        // Logical Shift Right Memory and Exclusive OR into A
+        INS_SRE_ZP = 0x47, // 5 ticks
+        INS_SRE_ZPX = 0x57; // 6 ticks
+
+    template <typename Bus>
+    static bool Execute(CPU6502& cpu, Byte instruction, s32& ticks, MEMORY& memory) {
+        switch (instruction) {
+        case INS_LAX_ZP: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.a = cpu.x = cpu.Read<Bus>(ticks, ZeroPageAddress, memory);
+            cpu.LDASetFlags();
+        } break;
+
+        case INS_LAX_ZPY: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, ZeroPageAddress, memory);
+            ZeroPageAddress += cpu.y;
+            cpu.a = cpu.x = cpu.Read<Bus>(ticks, ZeroPageAddress, memory);
+            cpu.LDASetFlags();
+        } break;
+
+        case INS_LAX_ABS: {
+            Word Address = cpu.FetchWord<Bus>(ticks, memory);
+            cpu.a = cpu.x = cpu.Read<Bus>(ticks, Address, memory);
+            cpu.LDASetFlags();
+        } break;
+
+        case INS_SAX_ZP: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Write<Bus>(ticks, cpu.a & cpu.x, ZeroPageAddress, memory);
+        } break;
+
+        case INS_SAX_ZPY: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, ZeroPageAddress, memory);
+            ZeroPageAddress += cpu.y;
+            cpu.Write<Bus>(ticks, cpu.a & cpu.x, ZeroPageAddress, memory);
+        } break;
+
+        case INS_SAX_ABS: {
+            Word Address = cpu.FetchWord<Bus>(ticks, memory);
+            cpu.Write<Bus>(ticks, cpu.a & cpu.x, Address, memory);
+        } break;
+
+        case INS_DCP_ZP: {
+            Byte ZeroPage = cpu.Fetch<Bus>(ticks, memory);
+            Byte value = cpu.Read<Bus>(ticks, ZeroPage, memory);
+            cpu.DummyWrite<Bus>(ticks, value, ZeroPage, memory);
+            value--;
+            cpu.Write<Bus>(ticks, value, ZeroPage, memory);
+            cpu.carry = cpu.a >= value;
+            cpu.zero = cpu.a == value;
+            cpu.negative = ((cpu.a - value) & 0b10000000) > 0;
+        } break;
+
+        case INS_DCP_ZPX: {
+            Byte ZeroPage = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, ZeroPage, memory);
+            ZeroPage += cpu.x;
+            Byte value = cpu.Read<Bus>(ticks, ZeroPage, memory);
+            cpu.DummyWrite<Bus>(ticks, value, ZeroPage, memory);
+            value--;
+            cpu.Write<Bus>(ticks, value, ZeroPage, memory);
+            cpu.carry = cpu.a >= value;
+            cpu.zero = cpu.a == value;
+            cpu.negative = ((cpu.a - value) & 0b10000000) > 0;
+        } break;
+
+        case INS_SLO_ZP: {
+            Byte ZeroPage = cpu.Fetch<Bus>(ticks, memory);
+            Byte value = cpu.Read<Bus>(ticks, ZeroPage, memory);
+            cpu.DummyWrite<Bus>(ticks, value, ZeroPage, memory);
+            cpu.carry = (value & 0b10000000) > 0;
+            value = value << 1;
+            cpu.Write<Bus>(ticks, value, ZeroPage, memory);
+            cpu.a |= value;
+            cpu.LDASetFlags();
+        } break;
+
+        case INS_SLO_ZPX: {
+            Byte ZeroPage = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, ZeroPage, memory);
+            ZeroPage += cpu.x;
+            Byte value = cpu.Read<Bus>(ticks, ZeroPage, memory);
+            cpu.DummyWrite<Bus>(ticks, value, ZeroPage, memory);
+            cpu.carry = (value & 0b10000000) > 0;
+            value = value << 1;
+            cpu.Write<Bus>(ticks, value, ZeroPage, memory);
+            cpu.a |= value;
+            cpu.LDASetFlags();
+        } break;
+
+        case INS_SRE_ZP: {
+            Byte ZeroPage = cpu.Fetch<Bus>(ticks, memory);
+            Byte value = cpu.Read<Bus>(ticks, ZeroPage, memory);
+            cpu.DummyWrite<Bus>(ticks, value, ZeroPage, memory);
+            cpu.carry = value & 1;
+            value = value >> 1;
+            cpu.Write<Bus>(ticks, value, ZeroPage, memory);
+            cpu.a ^= value;
+            cpu.LDASetFlags();
+        } break;
+
+        case INS_SRE_ZPX: {
+            Byte ZeroPage = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, ZeroPage, memory);
+            ZeroPage += cpu.x;
+            Byte value = cpu.Read<Bus>(ticks, ZeroPage, memory);
+            cpu.DummyWrite<Bus>(ticks, value, ZeroPage, memory);
+            cpu.carry = value & 1;
+            value = value >> 1;
+            cpu.Write<Bus>(ticks, value, ZeroPage, memory);
+            cpu.a ^= value;
+            cpu.LDASetFlags();
+        } break;
+
+        // NOP implied, 2 ticks
+        case 0x1A: case 0x3A: case 0x5A: case 0x7A: case 0xDA: case 0xFA: {
+            cpu.Idle<Bus>(ticks, cpu.program_counter, memory);
+        } break;
+
+        // NOP #, 2 ticks
+        case 0x80: case 0x82: case 0x89: case 0xC2: case 0xE2: {
+            cpu.Fetch<Bus>(ticks, memory);
+        } break;
+
+        // NOP zp, 3 ticks
+        case 0x04: case 0x44: case 0x64: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Read<Bus>(ticks, ZeroPageAddress, memory);
+        } break;
+
+        // NOP zp,X, 4 ticks
+        case 0x14: case 0x34: case 0x54: case 0x74: case 0xD4: case 0xF4: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, ZeroPageAddress, memory);
+            ZeroPageAddress += cpu.x;
+            cpu.Read<Bus>(ticks, ZeroPageAddress, memory);
+        } break;
+
+        // NOP abs, 4 ticks
+        case 0x0C: {
+            Word Address = cpu.FetchWord<Bus>(ticks, memory);
+            cpu.Read<Bus>(ticks, Address, memory);
+        } break;
+
+        default:
+            return false;
+        }
+        return true;
+    }
+};
+
+// CMOS 65C02
+struct CMOS_65C02 {
+    // Read-modify-write instructions read the operand a second time instead of writing it twice
+    template <typename Bus>
+    static void Modify(CPU6502& cpu, s32& ticks, Byte, Word address, MEMORY& memory) {
+        cpu.Idle<Bus>(ticks, address, memory);
+    }
+
+    static constexpr Byte
+
+        // Branch Always
+        INS_BRA = 0x80, // 3 ticks, 4 across a page
+
+        // Store Zero
+        INS_STZ_ZP = 0x64, // 3 ticks
+        INS_STZ_ZPX = 0x74, // 4 ticks
+        INS_STZ_ABS = 0x9C, // 4 ticks
+        INS_STZ_ABSX = 0x9E, // 5 ticks
+
+        // Push and pull x and y
+        INS_PHX = 0xDA, // 3 ticks
+        INS_PHY = 0x5A, // 3 ticks
+        INS_PLX = 0xFA, // 4 ticks
+        INS_PLY = 0x7A, // 4 ticks
+
+        // Test and Set or Reset Bits
+        INS_TSB_ZP = 0x04, // 5 ticks
+        INS_TRB_ZP = 0x14, // 5 ticks
+
+        // Increment and Decrement Accumulator
+        INS_INC_ACC = 0x1A, // 2 ticks
+        INS_DEC_ACC = 0x3A; // 2 ticks
+
+    template <typename Bus>
+    static bool Execute(CPU6502& cpu, Byte instruction, s32& ticks, MEMORY& memory) {
+        switch (instruction) {
+        case INS_BRA: {
+            signed char offset = cpu.Fetch<Bus>(ticks, memory);
+            Word Target = cpu.program_counter + offset;
+            cpu.Idle<Bus>(ticks, cpu.program_counter, memory);
+            if ((Target & 0xFF00) != (cpu.program_counter & 0xFF00)) {
+                cpu.Idle<Bus>(ticks, (cpu.program_counter & 0xFF00) | (Target & 0xFF), memory);
+            }
+            cpu.program_counter = Target;
+        } break;
+
+        case INS_STZ_ZP: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Write<Bus>(ticks, 0, ZeroPageAddress, memory);
+        } break;
+
+        case INS_STZ_ZPX: {
+            Byte ZeroPageAddress = cpu.Fetch<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, ZeroPageAddress, memory);
+            ZeroPageAddress += cpu.x;
+            cpu.Write<Bus>(ticks, 0, ZeroPageAddress, memory);
+        } break;
+
+        case INS_STZ_ABS: {
+            Word Address = cpu.FetchWord<Bus>(ticks, memory);
+            cpu.Write<Bus>(ticks, 0, Address, memory);
+        } break;
+
+        case INS_STZ_ABSX: {
+            Word Address = cpu.FetchWord<Bus>(ticks, memory);
+            cpu.Idle<Bus>(ticks, (Address & 0xFF00) | ((Address + cpu.x) & 0xFF), memory);
+            Address += cpu.x;
+            cpu.Write<Bus>(ticks, 0, Address, memory);
+        } break;
+
+        // Same stack layout as PHA and PLA
+        case INS_PHX:
+        case INS_PHY: {
+            cpu.WriteWord<Bus>(ticks, (instruction == INS_PHX ? cpu.x : cpu.y) << 8, cpu.stack_pointer, memory);
+            cpu.stack_pointer++;
+        } break;
+
+        case INS_PLX: {
+            cpu.x = cpu.Read<Bus>(ticks, cpu.stack_pointer, memory);
+            cpu.Write<Bus>(ticks, 0, cpu.stack_pointer, memory);
+            cpu.stack_pointer--;
+            cpu.LDXSetFlags();
+        } break;
+
+        case INS_PLY: {
+            cpu.y = cpu.Read<Bus>(ticks, cpu.stack_pointer, memory);
+            cpu.Write<Bus>(ticks, 0, cpu.stack_pointer, memory);
+            cpu.stack_pointer--;
+            cpu.LDYSetFlags();
+        } break;
+
+        case INS_TSB_ZP:
+        case INS_TRB_ZP: {
+            Byte ZeroPage = cpu.Fetch<Bus>(ticks, memory);
+            Byte value = cpu.Read<Bus>(ticks, ZeroPage, memory);
+            cpu.Idle<Bus>(ticks, ZeroPage, memory);
+            cpu.zero = (cpu.a & value) == 0;
+            value = instruction == INS_TSB_ZP ? value | cpu.a : value & ~cpu.a;
+            cpu.Write<Bus>(ticks, value, ZeroPage, memory);
+        } break;
+
+        case INS_INC_ACC: {
+            cpu.a++;
+            cpu.Idle<Bus>(ticks, cpu.program_counter, memory);
+            cpu.LDASetFlags();
+        } break;
+
+        case INS_DEC_ACC: {
+            cpu.a--;
+            cpu.Idle<Bus>(ticks, cpu.program_counter, memory);
+            cpu.LDASetFlags();
+        } break;
+
+        default:
+            return false;
+        }
+        return true;
+    }
+};
+
+// Addressing modes
+static constexpr Byte
+    MODE_IMPLIED = 0,
+    MODE_ACCUMULATOR = 1,
+    MODE_IMMEDIATE = 2,
+    MODE_ZERO_PAGE = 3,
+    MODE_ZERO_PAGE_X = 4,
+    MODE_ZERO_PAGE_Y = 5,
+    MODE_ABSOLUTE = 6,
+    MODE_ABSOLUTE_X = 7,
+    MODE_ABSOLUTE_Y = 8,
+    MODE_INDIRECT = 9,
+    MODE_INDEXED_INDIRECT = 10, // (zp,X)
+    MODE_INDIRECT_INDEXED = 11, // (zp),Y
+    MODE_RELATIVE = 12,
+    MODE_COUNT = 13;
+
+// Instruction length in bytes by addressing mode
+static constexpr Byte ModeLength[MODE_COUNT] = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 2, 2, 2 };
+
+struct OPCODE {
+    const char* Mnemonic; // nullptr when the opcode is not defined
+    Byte Mode;
+    Byte Cycles; // Base cycles, without page crossing or taken branch penalties
+};
+
+// Documented NMOS 6502 instruction set
+static const OPCODE Opcodes[256] = {
+    /* 0x00 */ { "BRK", MODE_IMPLIED, 7 },
+    /* 0x01 */ { "ORA", MODE_INDEXED_INDIRECT, 6 },
+    /* 0x02 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x03 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x04 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x05 */ { "ORA", MODE_ZERO_PAGE, 3 },
+    /* 0x06 */ { "ASL", MODE_ZERO_PAGE, 5 },
+    /* 0x07 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x08 */ { "PHP", MODE_IMPLIED, 3 },
+    /* 0x09 */ { "ORA", MODE_IMMEDIATE, 2 },
+    /* 0x0A */ { "ASL", MODE_ACCUMULATOR, 2 },
+    /* 0x0B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x0C */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x0D */ { "ORA", MODE_ABSOLUTE, 4 },
+    /* 0x0E */ { "ASL", MODE_ABSOLUTE, 6 },
+    /* 0x0F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x10 */ { "BPL", MODE_RELATIVE, 2 },
+    /* 0x11 */ { "ORA", MODE_INDIRECT_INDEXED, 5 },
+    /* 0x12 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x13 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x14 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x15 */ { "ORA", MODE_ZERO_PAGE_X, 4 },
+    /* 0x16 */ { "ASL", MODE_ZERO_PAGE_X, 6 },
+    /* 0x17 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x18 */ { "CLC", MODE_IMPLIED, 2 },
+    /* 0x19 */ { "ORA", MODE_ABSOLUTE_Y, 4 },
+    /* 0x1A */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x1B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x1C */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x1D */ { "ORA", MODE_ABSOLUTE_X, 4 },
+    /* 0x1E */ { "ASL", MODE_ABSOLUTE_X, 7 },
+    /* 0x1F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x20 */ { "JSR", MODE_ABSOLUTE, 6 },
+    /* 0x21 */ { "AND", MODE_INDEXED_INDIRECT, 6 },
+    /* 0x22 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x23 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x24 */ { "BIT", MODE_ZERO_PAGE, 3 },
+    /* 0x25 */ { "AND", MODE_ZERO_PAGE, 3 },
+    /* 0x26 */ { "ROL", MODE_ZERO_PAGE, 5 },
+    /* 0x27 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x28 */ { "PLP", MODE_IMPLIED, 4 },
+    /* 0x29 */ { "AND", MODE_IMMEDIATE, 2 },
+    /* 0x2A */ { "ROL", MODE_ACCUMULATOR, 2 },
+    /* 0x2B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x2C */ { "BIT", MODE_ABSOLUTE, 4 },
+    /* 0x2D */ { "AND", MODE_ABSOLUTE, 4 },
+    /* 0x2E */ { "ROL", MODE_ABSOLUTE, 6 },
+    /* 0x2F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x30 */ { "BMI", MODE_RELATIVE, 2 },
+    /* 0x31 */ { "AND", MODE_INDIRECT_INDEXED, 5 },
+    /* 0x32 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x33 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x34 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x35 */ { "AND", MODE_ZERO_PAGE_X, 4 },
+    /* 0x36 */ { "ROL", MODE_ZERO_PAGE_X, 6 },
+    /* 0x37 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x38 */ { "SEC", MODE_IMPLIED, 2 },
+    /* 0x39 */ { "AND", MODE_ABSOLUTE_Y, 4 },
+    /* 0x3A */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x3B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x3C */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x3D */ { "AND", MODE_ABSOLUTE_X, 4 },
+    /* 0x3E */ { "ROL", MODE_ABSOLUTE_X, 7 },
+    /* 0x3F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x40 */ { "RTI", MODE_IMPLIED, 6 },
+    /* 0x41 */ { "EOR", MODE_INDEXED_INDIRECT, 6 },
+    /* 0x42 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x43 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x44 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x45 */ { "EOR", MODE_ZERO_PAGE, 3 },
+    /* 0x46 */ { "LSR", MODE_ZERO_PAGE, 5 },
+    /* 0x47 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x48 */ { "PHA", MODE_IMPLIED, 3 },
+    /* 0x49 */ { "EOR", MODE_IMMEDIATE, 2 },
+    /* 0x4A */ { "LSR", MODE_ACCUMULATOR, 2 },
+    /* 0x4B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x4C */ { "JMP", MODE_ABSOLUTE, 3 },
+    /* 0x4D */ { "EOR", MODE_ABSOLUTE, 4 },
+    /* 0x4E */ { "LSR", MODE_ABSOLUTE, 6 },
+    /* 0x4F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x50 */ { "BVC", MODE_RELATIVE, 2 },
+    /* 0x51 */ { "EOR", MODE_INDIRECT_INDEXED, 5 },
+    /* 0x52 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x53 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x54 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x55 */ { "EOR", MODE_ZERO_PAGE_X, 4 },
+    /* 0x56 */ { "LSR", MODE_ZERO_PAGE_X, 6 },
+    /* 0x57 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x58 */ { "CLI", MODE_IMPLIED, 2 },
+    /* 0x59 */ { "EOR", MODE_ABSOLUTE_Y, 4 },
+    /* 0x5A */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x5B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x5C */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x5D */ { "EOR", MODE_ABSOLUTE_X, 4 },
+    /* 0x5E */ { "LSR", MODE_ABSOLUTE_X, 7 },
+    /* 0x5F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x60 */ { "RTS", MODE_IMPLIED, 6 },
+    /* 0x61 */ { "ADC", MODE_INDEXED_INDIRECT, 6 },
+    /* 0x62 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x63 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x64 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x65 */ { "ADC", MODE_ZERO_PAGE, 3 },
+    /* 0x66 */ { "ROR", MODE_ZERO_PAGE, 5 },
+    /* 0x67 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x68 */ { "PLA", MODE_IMPLIED, 4 },
+    /* 0x69 */ { "ADC", MODE_IMMEDIATE, 2 },
+    /* 0x6A */ { "ROR", MODE_ACCUMULATOR, 2 },
+    /* 0x6B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x6C */ { "JMP", MODE_INDIRECT, 5 },
+    /* 0x6D */ { "ADC", MODE_ABSOLUTE, 4 },
+    /* 0x6E */ { "ROR", MODE_ABSOLUTE, 6 },
+    /* 0x6F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x70 */ { "BVS", MODE_RELATIVE, 2 },
+    /* 0x71 */ { "ADC", MODE_INDIRECT_INDEXED, 5 },
+    /* 0x72 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x73 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x74 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x75 */ { "ADC", MODE_ZERO_PAGE_X, 4 },
+    /* 0x76 */ { "ROR", MODE_ZERO_PAGE_X, 6 },
+    /* 0x77 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x78 */ { "SEI", MODE_IMPLIED, 2 },
+    /* 0x79 */ { "ADC", MODE_ABSOLUTE_Y, 4 },
+    /* 0x7A */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x7B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x7C */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x7D */ { "ADC", MODE_ABSOLUTE_X, 4 },
+    /* 0x7E */ { "ROR", MODE_ABSOLUTE_X, 7 },
+    /* 0x7F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x80 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x81 */ { "STA", MODE_INDEXED_INDIRECT, 6 },
+    /* 0x82 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x83 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x84 */ { "STY", MODE_ZERO_PAGE, 3 },
+    /* 0x85 */ { "STA", MODE_ZERO_PAGE, 3 },
+    /* 0x86 */ { "STX", MODE_ZERO_PAGE, 3 },
+    /* 0x87 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x88 */ { "DEY", MODE_IMPLIED, 2 },
+    /* 0x89 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x8A */ { "TXA", MODE_IMPLIED, 2 },
+    /* 0x8B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x8C */ { "STY", MODE_ABSOLUTE, 4 },
+    /* 0x8D */ { "STA", MODE_ABSOLUTE, 4 },
+    /* 0x8E */ { "STX", MODE_ABSOLUTE, 4 },
+    /* 0x8F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x90 */ { "BCC", MODE_RELATIVE, 2 },
+    /* 0x91 */ { "STA", MODE_INDIRECT_INDEXED, 6 },
+    /* 0x92 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x93 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x94 */ { "STY", MODE_ZERO_PAGE_X, 4 },
+    /* 0x95 */ { "STA", MODE_ZERO_PAGE_X, 4 },
+    /* 0x96 */ { "STX", MODE_ZERO_PAGE_Y, 4 },
+    /* 0x97 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x98 */ { "TYA", MODE_IMPLIED, 2 },
+    /* 0x99 */ { "STA", MODE_ABSOLUTE_Y, 5 },
+    /* 0x9A */ { "TXS", MODE_IMPLIED, 2 },
+    /* 0x9B */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x9C */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x9D */ { "STA", MODE_ABSOLUTE_X, 5 },
+    /* 0x9E */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0x9F */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xA0 */ { "LDY", MODE_IMMEDIATE, 2 },
+    /* 0xA1 */ { "LDA", MODE_INDEXED_INDIRECT, 6 },
+    /* 0xA2 */ { "LDX", MODE_IMMEDIATE, 2 },
+    /* 0xA3 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xA4 */ { "LDY", MODE_ZERO_PAGE, 3 },
+    /* 0xA5 */ { "LDA", MODE_ZERO_PAGE, 3 },
+    /* 0xA6 */ { "LDX", MODE_ZERO_PAGE, 3 },
+    /* 0xA7 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xA8 */ { "TAY", MODE_IMPLIED, 2 },
+    /* 0xA9 */ { "LDA", MODE_IMMEDIATE, 2 },
+    /* 0xAA */ { "TAX", MODE_IMPLIED, 2 },
+    /* 0xAB */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xAC */ { "LDY", MODE_ABSOLUTE, 4 },
+    /* 0xAD */ { "LDA", MODE_ABSOLUTE, 4 },
+    /* 0xAE */ { "LDX", MODE_ABSOLUTE, 4 },
+    /* 0xAF */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xB0 */ { "BCS", MODE_RELATIVE, 2 },
+    /* 0xB1 */ { "LDA", MODE_INDIRECT_INDEXED, 5 },
+    /* 0xB2 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xB3 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xB4 */ { "LDY", MODE_ZERO_PAGE_X, 4 },
+    /* 0xB5 */ { "LDA", MODE_ZERO_PAGE_X, 4 },
+    /* 0xB6 */ { "LDX", MODE_ZERO_PAGE_Y, 4 },
+    /* 0xB7 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xB8 */ { "CLV", MODE_IMPLIED, 2 },
+    /* 0xB9 */ { "LDA", MODE_ABSOLUTE_Y, 4 },
+    /* 0xBA */ { "TSX", MODE_IMPLIED, 2 },
+    /* 0xBB */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xBC */ { "LDY", MODE_ABSOLUTE_X, 4 },
+    /* 0xBD */ { "LDA", MODE_ABSOLUTE_X, 4 },
+    /* 0xBE */ { "LDX", MODE_ABSOLUTE_Y, 4 },
+    /* 0xBF */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xC0 */ { "CPY", MODE_IMMEDIATE, 2 },
+    /* 0xC1 */ { "CMP", MODE_INDEXED_INDIRECT, 6 },
+    /* 0xC2 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xC3 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xC4 */ { "CPY", MODE_ZERO_PAGE, 3 },
+    /* 0xC5 */ { "CMP", MODE_ZERO_PAGE, 3 },
+    /* 0xC6 */ { "DEC", MODE_ZERO_PAGE, 5 },
+    /* 0xC7 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xC8 */ { "INY", MODE_IMPLIED, 2 },
+    /* 0xC9 */ { "CMP", MODE_IMMEDIATE, 2 },
+    /* 0xCA */ { "DEX", MODE_IMPLIED, 2 },
+    /* 0xCB */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xCC */ { "CPY", MODE_ABSOLUTE, 4 },
+    /* 0xCD */ { "CMP", MODE_ABSOLUTE, 4 },
+    /* 0xCE */ { "DEC", MODE_ABSOLUTE, 6 },
+    /* 0xCF */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xD0 */ { "BNE", MODE_RELATIVE, 2 },
+    /* 0xD1 */ { "CMP", MODE_INDIRECT_INDEXED, 5 },
+    /* 0xD2 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xD3 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xD4 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xD5 */ { "CMP", MODE_ZERO_PAGE_X, 4 },
+    /* 0xD6 */ { "DEC", MODE_ZERO_PAGE_X, 6 },
+    /* 0xD7 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xD8 */ { "CLD", MODE_IMPLIED, 2 },
+    /* 0xD9 */ { "CMP", MODE_ABSOLUTE_Y, 4 },
+    /* 0xDA */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xDB */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xDC */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xDD */ { "CMP", MODE_ABSOLUTE_X, 4 },
+    /* 0xDE */ { "DEC", MODE_ABSOLUTE_X, 7 },
+    /* 0xDF */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xE0 */ { "CPX", MODE_IMMEDIATE, 2 },
+    /* 0xE1 */ { "SBC", MODE_INDEXED_INDIRECT, 6 },
+    /* 0xE2 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xE3 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xE4 */ { "CPX", MODE_ZERO_PAGE, 3 },
+    /* 0xE5 */ { "SBC", MODE_ZERO_PAGE, 3 },
+    /* 0xE6 */ { "INC", MODE_ZERO_PAGE, 5 },
+    /* 0xE7 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xE8 */ { "INX", MODE_IMPLIED, 2 },
+    /* 0xE9 */ { "SBC", MODE_IMMEDIATE, 2 },
+    /* 0xEA */ { "NOP", MODE_IMPLIED, 2 },
+    /* 0xEB */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xEC */ { "CPX", MODE_ABSOLUTE, 4 },
+    /* 0xED */ { "SBC", MODE_ABSOLUTE, 4 },
+    /* 0xEE */ { "INC", MODE_ABSOLUTE, 6 },
+    /* 0xEF */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xF0 */ { "BEQ", MODE_RELATIVE, 2 },
+    /* 0xF1 */ { "SBC", MODE_INDIRECT_INDEXED, 5 },
+    /* 0xF2 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xF3 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xF4 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xF5 */ { "SBC", MODE_ZERO_PAGE_X, 4 },
+    /* 0xF6 */ { "INC", MODE_ZERO_PAGE_X, 6 },
+    /* 0xF7 */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xF8 */ { "SED", MODE_IMPLIED, 2 },
+    /* 0xF9 */ { "SBC", MODE_ABSOLUTE_Y, 4 },
+    /* 0xFA */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xFB */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xFC */ { nullptr, MODE_IMPLIED, 0 },
+    /* 0xFD */ { "SBC", MODE_ABSOLUTE_X, 4 },
+    /* 0xFE */ { "INC", MODE_ABSOLUTE_X, 7 },
+    /* 0xFF */ { nullptr, MODE_IMPLIED, 0 },
+};
+
+// Mnemonic and addressing mode back to the opcode, built once per instruction set
+struct OPCODE_LOOKUP {
+    static constexpr u32 KEYS = 26 * 26 * 26;
+    static constexpr u32 ROWS = 80; // Distinct mnemonics
+
+    s16 Slots[KEYS]; // Mnemonic key to row in Encoding
+    s16 Encoding[ROWS][MODE_COUNT]; // Opcode, or -1 when the mode does not exist
+    s16 Rows;
+
+    OPCODE_LOOKUP() {
+        for (u32 i = 0; i < KEYS; i++) {
+            Slots[i] = -1;
+        }
+        for (u32 i = 0; i < ROWS; i++) {
+            for (u32 mode = 0; mode < MODE_COUNT; mode++) {
+                Encoding[i][mode] = -1;
+            }
+        }
+        Rows = 0;
+    }
+
+    // The first opcode added for a mnemonic and mode is the one that gets encoded
+    void Add(Byte op, const OPCODE& info) {
+        s32 key = Key(info.Mnemonic, 3);
+        if (Slots[key] < 0) {
+            if (Rows == (s16)ROWS) {
+                return; // No row left, the mnemonic cannot be assembled
+            }
+            Slots[key] = Rows++;
+        }
+        if (Encoding[Slots[key]][info.Mode] < 0) {
+            Encoding[Slots[key]][info.Mode] = op;
+        }
+    }
+
+    // Case insensitive three letter key, -1 for anything else
+    static s32 Key(const char* name, u32 length) {
+        if (length != 3) {
+            return -1;
+        }
+        s32 key = 0;
+        for (u32 i = 0; i < 3; i++) {
+            char c = asciitolower(name[i]);
+            if (c < 'a' || c > 'z') {
+                return -1;
+            }
+            key = key * 26 + (c - 'a');
+        }
+        return key;
+    }
+
+    // Row of the mnemonic in Encoding, -1 when unknown
+    s32 Find(const char* name, u32 length) const {
+        s32 key = Key(name, length);
+        return key < 0 ? -1 : Slots[key];
+    }
+};
+
+// An opcode a CPU variant defines on top of the documented set
+struct OPCODE_EXTENSION {
+    Byte Opcode;
+    OPCODE Info;
+};
+
+// Stable undocumented NMOS opcodes. Where several opcodes do the same, the assembler emits the first one listed.
+static const OPCODE_EXTENSION UndocumentedOpcodes[] = {
+    { 0xA7, { "LAX", MODE_ZERO_PAGE, 3 } },
+    { 0xB7, { "LAX", MODE_ZERO_PAGE_Y, 4 } },
+    { 0xAF, { "LAX", MODE_ABSOLUTE, 4 } },
+    { 0x87, { "SAX", MODE_ZERO_PAGE, 3 } },
+    { 0x97, { "SAX", MODE_ZERO_PAGE_Y, 4 } },
+    { 0x8F, { "SAX", MODE_ABSOLUTE, 4 } },
+    { 0xC7, { "DCP", MODE_ZERO_PAGE, 5 } },
+    { 0xD7, { "DCP", MODE_ZERO_PAGE_X, 6 } },
+    { 0x07, { "SLO", MODE_ZERO_PAGE, 5 } },
+    { 0x17, { "SLO", MODE_ZERO_PAGE_X, 6 } },
+    { 0x47, { "SRE", MODE_ZERO_PAGE, 5 } },
+    { 0x57, { "SRE", MODE_ZERO_PAGE_X, 6 } },
+    { 0x1A, { "NOP", MODE_IMPLIED, 2 } },
+    { 0x3A, { "NOP", MODE_IMPLIED, 2 } },
+    { 0x5A, { "NOP", MODE_IMPLIED, 2 } },
+    { 0x7A, { "NOP", MODE_IMPLIED, 2 } },
+    { 0xDA, { "NOP", MODE_IMPLIED, 2 } },
+    { 0xFA, { "NOP", MODE_IMPLIED, 2 } },
+    { 0x80, { "NOP", MODE_IMMEDIATE, 2 } },
+    { 0x82, { "NOP", MODE_IMMEDIATE, 2 } },
+    { 0x89, { "NOP", MODE_IMMEDIATE, 2 } },
+    { 0xC2, { "NOP", MODE_IMMEDIATE, 2 } },
+    { 0xE2, { "NOP", MODE_IMMEDIATE, 2 } },
+    { 0x04, { "NOP", MODE_ZERO_PAGE, 3 } },
+    { 0x44, { "NOP", MODE_ZERO_PAGE, 3 } },
+    { 0x64, { "NOP", MODE_ZERO_PAGE, 3 } },
+    { 0x14, { "NOP", MODE_ZERO_PAGE_X, 4 } },
+    { 0x34, { "NOP", MODE_ZERO_PAGE_X, 4 } },
+    { 0x54, { "NOP", MODE_ZERO_PAGE_X, 4 } },
+    { 0x74, { "NOP", MODE_ZERO_PAGE_X, 4 } },
+    { 0xD4, { "NOP", MODE_ZERO_PAGE_X, 4 } },
+    { 0xF4, { "NOP", MODE_ZERO_PAGE_X, 4 } },
+    { 0x0C, { "NOP", MODE_ABSOLUTE, 4 } },
+};
+
+// 65C02 additions
+static const OPCODE_EXTENSION Cmos65C02Opcodes[] = {
+    { 0x80, { "BRA", MODE_RELATIVE, 3 } },
+    { 0x64, { "STZ", MODE_ZERO_PAGE, 3 } },
+    { 0x74, { "STZ", MODE_ZERO_PAGE_X, 4 } },
+    { 0x9C, { "STZ", MODE_ABSOLUTE, 4 } },
+    { 0x9E, { "STZ", MODE_ABSOLUTE_X, 5 } },
+    { 0xDA, { "PHX", MODE_IMPLIED, 3 } },
+    { 0x5A, { "PHY", MODE_IMPLIED, 3 } },
+    { 0xFA, { "PLX", MODE_IMPLIED, 4 } },
+    { 0x7A, { "PLY", MODE_IMPLIED, 4 } },
+    { 0x04, { "TSB", MODE_ZERO_PAGE, 5 } },
+    { 0x14, { "TRB", MODE_ZERO_PAGE, 5 } },
+    { 0x1A, { "INC", MODE_ACCUMULATOR, 2 } },
+    { 0x3A, { "DEC", MODE_ACCUMULATOR, 2 } },
+};
+
+// Opcode table of a CPU variant, with the lookup the assembler encodes from
+struct INSTRUCTION_SET {
+    OPCODE Table[256];
+    OPCODE_LOOKUP Lookup;
+
+    INSTRUCTION_SET(const OPCODE_EXTENSION* extensions = nullptr, u32 count = 0) {
+        for (u32 op = 0; op < 256; op++) {
+            Table[op] = Opcodes[op];
+            if (Table[op].Mnemonic != nullptr) {
+                Lookup.Add(op, Table[op]);
+            }
+        }
+        for (u32 i = 0; i < count; i++) {
+            Table[extensions[i].Opcode] = extensions[i].Info;
+            Lookup.Add(extensions[i].Opcode, extensions[i].Info);
+        }
+    }
+};
+
+static const INSTRUCTION_SET NmosInstructions;
+static const INSTRUCTION_SET UndocumentedInstructions(UndocumentedOpcodes, sizeof(UndocumentedOpcodes) / sizeof(UndocumentedOpcodes[0]));
+static const INSTRUCTION_SET Cmos65C02Instructions(Cmos65C02Opcodes, sizeof(Cmos65C02Opcodes) / sizeof(Cmos65C02Opcodes[0]));
+
+// Single pass assembler for standard 6502 syntax. Forward references are emitted as
+// placeholders and patched from a fixup list once the source is consumed. Code goes
+// straight into memory, and symbols and fixups live in the arena.
+//
+//     label:  LDA #<table      ; comments
+//             STA $10,X
+//     COUNT = 4
+//             .org $FF00
+//             .byte 1, $02, %11, 'a', "text"
+//             .word label + 2
+struct ASSEMBLER {
+    struct SYMBOL {
+        const char* Name;
+        u32 Length;
+        s32 Value;
+        bool Defined;
+    };
+
+    // Value of an expression, with at most one symbol that is not defined yet
+    struct VALUE {
+        s32 Number;
+        s32 Symbol; // Index into Symbols, -1 when resolved
+        Byte Select; // SELECT_*
+    };
+
+    struct FIXUP {
+        u32 Address;
+        u32 Symbol;
+        s32 Addend;
+        u32 Line;
+        Byte Kind;
+        Byte Select;
+    };
+
+    static constexpr Byte
+        SELECT_NONE = 0,
+        SELECT_LOW = 1, // <expression
+        SELECT_HIGH = 2; // >expression
+
+    static constexpr Byte
+        FIX_BYTE = 0,
+        FIX_WORD = 1,
+        FIX_RELATIVE = 2;
+
+    MEMORY* memory = nullptr;
+    ARENA* arena = nullptr;
+    const INSTRUCTION_SET* InstructionSet = &NmosInstructions;
+
+    SYMBOL* Symbols = nullptr;
+    u32 SymbolCount = 0;
+    u32 SymbolCapacity = 0;
+    u32* Slots = nullptr; // Open addressing index into Symbols, 0 when empty
+    u32 SlotCount = 0;
+
+    FIXUP* Fixups = nullptr;
+    u32 FixupCount = 0;
+    u32 FixupCapacity = 0;
+
+    char* cursor = nullptr;
+    u32 Line = 0;
+    u32 Address = 0;
+
+    // Results
+    bool HasCode = false;
+    Word Entry = 0; // First instruction
+    Word LowestCode = 0xFFFF; // Lowest instruction address
+    s32 ticks = 0; // Sum of the base cycles of every instruction
+    char Error[160];
+
+    bool Fail(const char* message, const char* detail = "", u32 length = 0) {
+        snprintf(Error, sizeof(Error), "line %u: %s%.*s", Line, message, (int)length, detail);
+        return false;
+    }
+
+    static bool IsIdentifierStart(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '.';
+    }
+
+    static bool IsIdentifier(char c) {
+        return IsIdentifierStart(c) || (c >= '0' && c <= '9');
+    }
+
+    void SkipBlanks() {
+        while (*cursor == ' ' || *cursor == '\t' || *cursor == '\r') {
+            cursor++;
+        }
+    }
+
+    bool AtEndOfStatement() {
+        SkipBlanks();
+        return *cursor == '\0' || *cursor == '\n' || *cursor == ';';
+    }
+
+    // Doubles an arena array, the old block stays behind until the arena is reset
+    template <typename T>
+    bool Grow(T*& items, u32& capacity, u32 count) {
+        u32 NewCapacity = capacity == 0 ? 1024 : capacity * 2;
+        T* NewItems = (T*)arena->Allocate(NewCapacity * sizeof(T));
+        if (NewItems == nullptr) {
+            return Fail("out of arena memory");
+        }
+        if (count > 0) {
+            memcpy(NewItems, items, count * sizeof(T));
+        }
+        items = NewItems;
+        capacity = NewCapacity;
+        return true;
+    }
+
+    static u32 Hash(const char* name, u32 length) {
+        return Checksum((const Byte*)name, length);
+    }
+
+    bool Rehash() {
+        u32 NewCount = SlotCount == 0 ? 2048 : SlotCount * 2;
+        u32* NewSlots = (u32*)arena->Allocate(NewCount * sizeof(u32));
+        if (NewSlots == nullptr) {
+            return Fail("out of arena memory");
+        }
+        memset(NewSlots, 0, NewCount * sizeof(u32));
+        for (u32 i = 0; i < SymbolCount; i++) {
+            u32 slot = Hash(Symbols[i].Name, Symbols[i].Length) & (NewCount - 1);
+            while (NewSlots[slot] != 0) {
+                slot = (slot + 1) & (NewCount - 1);
+            }
+            NewSlots[slot] = i + 1;
+        }
+        Slots = NewSlots;
+        SlotCount = NewCount;
+        return true;
+    }
+
+    // Index of the symbol, created undefined on first use. -1 when out of memory.
+    s32 Intern(const char* name, u32 length) {
+        if ((SymbolCount + 1) * 2 > SlotCount && !Rehash()) {
+            return -1;
+        }
+        u32 slot = Hash(name, length) & (SlotCount - 1);
+        while (Slots[slot] != 0) {
+            SYMBOL& symbol = Symbols[Slots[slot] - 1];
+            if (symbol.Length == length && memcmp(symbol.Name, name, length) == 0) {
+                return Slots[slot] - 1;
+            }
+            slot = (slot + 1) & (SlotCount - 1);
+        }
+
+        if (SymbolCount == SymbolCapacity && !Grow(Symbols, SymbolCapacity, SymbolCount)) {
+            return -1;
+        }
+        Symbols[SymbolCount] = { name, length, 0, false };
+        Slots[slot] = ++SymbolCount;
+        return SymbolCount - 1;
+    }
+
+    bool Define(const char* name, u32 length, s32 value) {
+        s32 index = Intern(name, length);
+        if (index < 0) {
+            return false;
+        }
+        if (Symbols[index].Defined) {
+            return Fail("symbol defined twice: ", name, length);
+        }
+        Symbols[index].Value = value;
+        Symbols[index].Defined = true;
+        return true;
+    }
+
+    bool Number(s32& value) {
+        u32 base = 10;
+        if (*cursor == '$') {
+            base = 16;
+            cursor++;
+        }
+        else if (*cursor == '%') {
+            base = 2;
+            cursor++;
+        }
+
+        const char* start = cursor;
+        s64 result = 0;
+        while (true) {
+            char c = asciitolower(*cursor);
+            u32 digit;
+            if (c >= '0' && c <= '9')
+                digit = c - '0';
+            else if (c >= 'a' && c <= 'f')
+                digit = c - 'a' + 10;
+            else {
+                break;
+            }
+            if (digit >= base) {
+                break;
+            }
+            result = result * base + digit;
+            if (result > 0xFFFFFF) {
+                return Fail("number too large");
+            }
+            cursor++;
+        }
+        if (cursor == start || IsIdentifier(*cursor)) {
+            return Fail("malformed number");
+        }
+        value = result;
+        return true;
+    }
 
-    string result = cpu.ReadFileInstructions("./program.xndr");
+    bool Term(VALUE& value) {
+        SkipBlanks();
+        value = { 0, -1, SELECT_NONE };
 
-    u32 ticks = cpu.splitByNewLine(result, memory);
+        if (*cursor == '-') {
+            cursor++;
+            if (!Term(value)) {
+                return false;
+            }
+            if (value.Symbol >= 0) {
+                return Fail("a forward reference cannot be negated");
+            }
+            value.Number = -value.Number;
+            return true;
+        }
+        if (*cursor == '*') {
+            cursor++;
+            value.Number = Address;
+            return true;
+        }
+        if (*cursor == '\'') {
+            if (cursor[1] == '\0' || cursor[2] != '\'') {
+                return Fail("malformed character literal");
+            }
+            value.Number = (Byte)cursor[1];
+            cursor += 3;
+            return true;
+        }
+        if (*cursor == '$' || *cursor == '%' || (*cursor >= '0' && *cursor <= '9')) {
+            return Number(value.Number);
+        }
+        if (IsIdentifierStart(*cursor)) {
+            const char* name = cursor;
+            while (IsIdentifier(*cursor)) {
+                cursor++;
+            }
+            s32 index = Intern(name, cursor - name);
+            if (index < 0) {
+                return false;
+            }
+            if (Symbols[index].Defined)
+                value.Number = Symbols[index].Value;
+            else {
+                value.Symbol = index;
+            }
+            return true;
+        }
+        return Fail("expected an expression");
+    }
+
+    // [<|>] term {(+|-) term}
+    bool Expression(VALUE& value) {
+        SkipBlanks();
+        Byte select = SELECT_NONE;
+        if (*cursor == '<' || *cursor == '>') {
+            select = *cursor == '<' ? SELECT_LOW : SELECT_HIGH;
+            cursor++;
+        }
+
+        if (!Term(value)) {
+            return false;
+        }
+        while (true) {
+            SkipBlanks();
+            if (*cursor != '+' && *cursor != '-') {
+                break;
+            }
+            bool subtract = *cursor++ == '-';
+            VALUE right;
+            if (!Term(right)) {
+                return false;
+            }
+            if (right.Symbol >= 0 && (subtract || value.Symbol >= 0)) {
+                return Fail("a forward reference may only be added once");
+            }
+            if (right.Symbol >= 0) {
+                value.Symbol = right.Symbol;
+            }
+            value.Number += subtract ? -right.Number : right.Number;
+        }
+
+        value.Select = select;
+        if (value.Symbol < 0) {
+            value.Number = Selected(value.Number, select);
+        }
+        return true;
+    }
+
+    static s32 Selected(s32 number, Byte select) {
+        if (select == SELECT_LOW) {
+            return number & 0xFF;
+        }
+        if (select == SELECT_HIGH) {
+            return (number >> 8) & 0xFF;
+        }
+        return number;
+    }
+
+    bool EmitByte(Byte value) {
+        if (Address >= MEMORY::MAX_MEMORY) {
+            return Fail("program runs past the end of memory");
+        }
+        (*memory)[Address] = value;
+        Address++;
+        return true;
+    }
+
+    // Writes an already resolved value, checking it fits
+    bool Patch(u32 address, s32 value, Byte kind) {
+        if (kind == FIX_RELATIVE) {
+            value -= address + 1;
+            if (value < -128 || value > 127) {
+                return Fail("branch target out of range");
+            }
+            (*memory)[address] = value & 0xFF;
+            return true;
+        }
+        if (kind == FIX_BYTE) {
+            if (value < -128 || value > 0xFF) {
+                return Fail("value does not fit in a byte");
+            }
+            (*memory)[address] = value & 0xFF;
+            return true;
+        }
+        if (value < -32768 || value > 0xFFFF) {
+            return Fail("value does not fit in a word");
+        }
+        (*memory)[address] = value & 0xFF;
+        (*memory)[(address + 1) % MEMORY::MAX_MEMORY] = (value >> 8) & 0xFF;
+        return true;
+    }
+
+    bool EmitValue(const VALUE& value, Byte kind) {
+        u32 at = Address;
+        u32 size = kind == FIX_WORD ? 2 : 1;
+        for (u32 i = 0; i < size; i++) {
+            if (!EmitByte(0)) {
+                return false;
+            }
+        }
+        if (value.Symbol < 0) {
+            return Patch(at, value.Number, kind);
+        }
+
+        if (FixupCount == FixupCapacity && !Grow(Fixups, FixupCapacity, FixupCount)) {
+            return false;
+        }
+        Fixups[FixupCount++] = { at, (u32)value.Symbol, value.Number, Line, kind, value.Select };
+        return true;
+    }
+
+    bool Instruction(s32 row, const char* name, u32 length) {
+        const s16* modes = InstructionSet->Lookup.Encoding[row];
+        Byte mode;
+        VALUE operand = { 0, -1, SELECT_NONE };
+
+        if (AtEndOfStatement()) {
+            mode = modes[MODE_IMPLIED] >= 0 ? MODE_IMPLIED : MODE_ACCUMULATOR;
+        }
+        else if ((*cursor == 'A' || *cursor == 'a') && !IsIdentifier(cursor[1])) {
+            cursor++;
+            mode = MODE_ACCUMULATOR;
+        }
+        else if (*cursor == '#') {
+            cursor++;
+            if (!Expression(operand)) {
+                return false;
+            }
+            mode = MODE_IMMEDIATE;
+        }
+        else if (*cursor == '(') {
+            cursor++;
+            if (!Expression(operand)) {
+                return false;
+            }
+            SkipBlanks();
+            if (*cursor == ',') {
+                cursor++;
+                SkipBlanks();
+                if (asciitolower(cursor[0]) != 'x' || cursor[1] != ')') {
+                    return Fail("expected ,X)");
+                }
+                cursor += 2;
+                mode = MODE_INDEXED_INDIRECT;
+            }
+            else if (*cursor == ')') {
+                cursor++;
+                SkipBlanks();
+                mode = MODE_INDIRECT;
+                if (*cursor == ',') {
+                    cursor++;
+                    SkipBlanks();
+                    if (asciitolower(*cursor) != 'y') {
+                        return Fail("expected ),Y");
+                    }
+                    cursor++;
+                    mode = MODE_INDIRECT_INDEXED;
+                }
+            }
+            else {
+                return Fail("expected )");
+            }
+        }
+        else {
+            if (!Expression(operand)) {
+                return false;
+            }
+            Byte index = 0;
+            SkipBlanks();
+            if (*cursor == ',') {
+                cursor++;
+                SkipBlanks();
+                index = asciitolower(*cursor);
+                if (index != 'x' && index != 'y') {
+                    return Fail("expected X or Y index");
+                }
+                cursor++;
+            }
+
+            Byte ZeroPage = index == 0 ? MODE_ZERO_PAGE : index == 'x' ? MODE_ZERO_PAGE_X : MODE_ZERO_PAGE_Y;
+            Byte Absolute = index == 0 ? MODE_ABSOLUTE : index == 'x' ? MODE_ABSOLUTE_X : MODE_ABSOLUTE_Y;
+
+            // Forward references assume absolute addressing unless only zero page exists
+            bool FitsZeroPage = operand.Symbol < 0 ? (operand.Number >= 0 && operand.Number <= 0xFF)
+                                                   : (operand.Select != SELECT_NONE || modes[Absolute] < 0);
+            if (index == 0 && modes[MODE_RELATIVE] >= 0)
+                mode = MODE_RELATIVE;
+            else if (FitsZeroPage && modes[ZeroPage] >= 0)
+                mode = ZeroPage;
+            else {
+                mode = Absolute;
+            }
+        }
+
+        if (modes[mode] < 0) {
+            return Fail("addressing mode not available for ", name, length);
+        }
+
+        Byte opcode = modes[mode];
+        if (!HasCode) {
+            HasCode = true;
+            Entry = Address;
+        }
+        if (Address < LowestCode) {
+            LowestCode = Address;
+        }
+        ticks += InstructionSet->Table[opcode].Cycles;
+        if (!EmitByte(opcode)) {
+            return false;
+        }
+
+        switch (ModeLength[mode]) {
+        case 1:
+            return true;
+        case 2:
+            return EmitValue(operand, mode == MODE_RELATIVE ? FIX_RELATIVE : FIX_BYTE);
+        default:
+            return EmitValue(operand, FIX_WORD);
+        }
+    }
+
+    bool Directive(const char* name, u32 length) {
+        auto Is = [&](const char* directive) {
+            return strlen(directive) == length && strncmp(directive, name, length) == 0;
+        };
+
+        if (Is(".org")) {
+            VALUE origin;
+            if (!Expression(origin)) {
+                return false;
+            }
+            if (origin.Symbol >= 0 || origin.Number < 0 || origin.Number > 0xFFFF) {
+                return Fail(".org needs a defined address");
+            }
+            Address = origin.Number;
+            return true;
+        }
+
+        if (Is(".byte") || Is(".word")) {
+            Byte kind = Is(".byte") ? FIX_BYTE : FIX_WORD;
+            do {
+                SkipBlanks();
+                if (*cursor == '"' && kind == FIX_BYTE) {
+                    cursor++;
+                    while (*cursor != '"') {
+                        if (*cursor == '\0' || *cursor == '\n') {
+                            return Fail("unterminated string");
+                        }
+                        if (!EmitByte(*cursor++)) {
+                            return false;
+                        }
+                    }
+                    cursor++;
+                }
+                else {
+                    VALUE item;
+                    if (!Expression(item) || !EmitValue(item, kind)) {
+                        return false;
+                    }
+                }
+                SkipBlanks();
+                if (*cursor != ',') {
+                    return true;
+                }
+                cursor++;
+            } while (true);
+        }
+
+        return Fail("unknown directive ", name, length);
+    }
+
+    // [label:] [instruction | directive | name = expression]
+    bool Statement() {
+        while (!AtEndOfStatement()) {
+            if (!IsIdentifierStart(*cursor)) {
+                return Fail("expected a label, instruction or directive");
+            }
+            const char* name = cursor;
+            while (IsIdentifier(*cursor)) {
+                cursor++;
+            }
+            u32 length = cursor - name;
+            SkipBlanks();
+
+            if (*cursor == ':') {
+                cursor++;
+                if (!Define(name, length, Address)) {
+                    return false;
+                }
+                continue;
+            }
+            if (*cursor == '=') {
+                cursor++;
+                VALUE value;
+                if (!Expression(value)) {
+                    return false;
+                }
+                if (value.Symbol >= 0) {
+                    return Fail("constants cannot use forward references");
+                }
+                if (!Define(name, length, value.Number)) {
+                    return false;
+                }
+                break;
+            }
+            if (name[0] == '.') {
+                if (!Directive(name, length)) {
+                    return false;
+                }
+                break;
+            }
+
+            s32 row = InstructionSet->Lookup.Find(name, length);
+            if (row < 0) {
+                return Fail("unknown instruction ", name, length);
+            }
+            if (!Instruction(row, name, length)) {
+                return false;
+            }
+            break;
+        }
+
+        if (!AtEndOfStatement()) {
+            return Fail("unexpected text after statement");
+        }
+        return true;
+    }
+
+    bool Assemble(char* source, Word origin, MEMORY& target, ARENA& scratch) {
+        memory = &target;
+        arena = &scratch;
+        Symbols = nullptr;
+        SymbolCount = SymbolCapacity = 0;
+        Slots = nullptr;
+        SlotCount = 0;
+        Fixups = nullptr;
+        FixupCount = FixupCapacity = 0;
+        HasCode = false;
+        Entry = origin;
+        LowestCode = 0xFFFF;
+        ticks = 0;
+        Error[0] = '\0';
+
+        cursor = source;
+        Address = origin;
+        Line = 1;
+        while (*cursor != '\0') {
+            if (!Statement()) {
+                return false;
+            }
+            while (*cursor != '\0' && *cursor != '\n') {
+                cursor++;
+            }
+            if (*cursor == '\n') {
+                cursor++;
+                Line++;
+            }
+        }
+
+        for (u32 i = 0; i < FixupCount; i++) {
+            const FIXUP& fixup = Fixups[i];
+            const SYMBOL& symbol = Symbols[fixup.Symbol];
+            Line = fixup.Line;
+            if (!symbol.Defined) {
+                return Fail("undefined symbol ", symbol.Name, symbol.Length);
+            }
+            if (!Patch(fixup.Address, Selected(symbol.Value + fixup.Addend, fixup.Select), fixup.Kind)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void WriteSymbols(FILE* Output) const {
+        for (u32 i = 0; i < SymbolCount; i++) {
+            if (Symbols[i].Defined) {
+                fprintf(Output, "%.*s = $%04X\n", (int)Symbols[i].Length, Symbols[i].Name, Symbols[i].Value & 0xFFFF);
+            }
+        }
+    }
+};
+
+// Result of a static pass over a loaded image: which bytes are instructions, where basic
+// blocks start and which addresses are jumped to.
+struct CODE_MAP {
+    struct DECODED {
+        Byte Opcode;
+        Byte Length;
+        Word Operand;
+    };
+
+    Byte Code[MEMORY::MAX_MEMORY / 8]; // Byte belongs to an instruction
+    Byte Starts[MEMORY::MAX_MEMORY / 8]; // Instruction starts here
+    Byte Blocks[MEMORY::MAX_MEMORY / 8]; // Basic block starts here
+    Byte Targets[MEMORY::MAX_MEMORY / 8]; // Jumped, branched or called to
+
+    Word Lowest; // Code range
+    Word Highest;
+    u32 Instructions;
+
+    const INSTRUCTION_SET* InstructionSet = &NmosInstructions;
+
+    // Address to symbol index + 1 when built from an assembled program
+    const ASSEMBLER* Symbols;
+    u32* SymbolIndex;
+
+    static void Set(Byte* Bitmap, u32 Address) {
+        Bitmap[Address / 8] |= 1 << (Address % 8);
+    }
+
+    bool IsCode(Word Address) const {
+        return MEMORY::TestBit(Code, Address);
+    }
+
+    bool IsStart(Word Address) const {
+        return MEMORY::TestBit(Starts, Address);
+    }
+
+    bool IsBlock(Word Address) const {
+        return MEMORY::TestBit(Blocks, Address);
+    }
 
-    cpu.Execute(ticks, memory);
+    bool IsTarget(Word Address) const {
+        return MEMORY::TestBit(Targets, Address);
+    }
+
+    DECODED Decode(const MEMORY& memory, Word Address) const {
+        DECODED decoded;
+        decoded.Opcode = memory[Address];
+        decoded.Length = ModeLength[InstructionSet->Table[decoded.Opcode].Mode];
+        decoded.Operand = 0;
+        if (decoded.Length > 1) {
+            decoded.Operand = memory[(Address + 1) % MEMORY::MAX_MEMORY];
+        }
+        if (decoded.Length > 2) {
+            decoded.Operand |= memory[(Address + 2) % MEMORY::MAX_MEMORY] << 8;
+        }
+        return decoded;
+    }
+
+    static Word BranchTarget(Word Address, const DECODED& decoded) {
+        return Address + 2 + (signed char)decoded.Operand;
+    }
+
+    // Follows control flow from the entry points. Bytes never reached stay data.
+    void Analyze(const MEMORY& memory, const Word* Entries, u32 EntryCount, ARENA& arena, const ASSEMBLER* assembler = nullptr) {
+        memset(Code, 0, sizeof(Code));
+        memset(Starts, 0, sizeof(Starts));
+        memset(Blocks, 0, sizeof(Blocks));
+        memset(Targets, 0, sizeof(Targets));
+        Lowest = 0xFFFF;
+        Highest = 0;
+        Instructions = 0;
+
+        Word* Pending = (Word*)arena.Allocate(MEMORY::MAX_MEMORY * sizeof(Word));
+        u32 PendingCount = 0;
+        for (u32 i = 0; i < EntryCount && Pending != nullptr; i++) {
+            Pending[PendingCount++] = Entries[i];
+            Set(Blocks, Entries[i]);
+        }
+
+        while (PendingCount > 0) {
+            u32 Address = Pending[--PendingCount];
+
+            while (Address < MEMORY::MAX_MEMORY && !IsStart(Address)) {
+                DECODED decoded = Decode(memory, Address);
+                const OPCODE& info = InstructionSet->Table[decoded.Opcode];
+                if (info.Mnemonic == nullptr || Address + decoded.Length > MEMORY::MAX_MEMORY) {
+                    break;
+                }
+                // Overlapping a known instruction at another alignment means this path is data
+                bool Overlaps = false;
+                for (u32 i = 0; i < decoded.Length; i++) {
+                    Overlaps |= IsCode(Address + i);
+                }
+                if (Overlaps) {
+                    break;
+                }
+
+                for (u32 i = 0; i < decoded.Length; i++) {
+                    Set(Code, Address + i);
+                }
+                Set(Starts, Address);
+                Instructions++;
+                if (Address < Lowest) {
+                    Lowest = Address;
+                }
+                if (Address + decoded.Length - 1 > Highest) {
+                    Highest = Address + decoded.Length - 1;
+                }
+
+                Word Target = decoded.Operand;
+                bool Continues = true;
+                bool Jumps = false;
+                if (info.Mode == MODE_RELATIVE) {
+                    Target = BranchTarget(Address, decoded);
+                    Jumps = true;
+                    Continues = strcmp(info.Mnemonic, "BRA") != 0;
+                }
+                else if (decoded.Opcode == CPU6502::INS_JSR) {
+                    Jumps = true;
+                }
+                else if (decoded.Opcode == CPU6502::INS_JMP) {
+                    Jumps = true;
+                    Continues = false;
+                }
+                else if (strcmp(info.Mnemonic, "JMP") == 0 || strcmp(info.Mnemonic, "RTS") == 0
+                    || strcmp(info.Mnemonic, "RTI") == 0 || strcmp(info.Mnemonic, "BRK") == 0) {
+                    Continues = false;
+                }
+
+                if (Jumps) {
+                    Set(Targets, Target);
+                    Set(Blocks, Target);
+                    Pending[PendingCount++] = Target;
+                }
+                Address += decoded.Length;
+                if (Jumps || !Continues) {
+                    Set(Blocks, Address % MEMORY::MAX_MEMORY);
+                }
+                if (!Continues) {
+                    break;
+                }
+            }
+        }
+
+        Symbols = assembler;
+        SymbolIndex = nullptr;
+        if (assembler != nullptr) {
+            SymbolIndex = (u32*)arena.Allocate(MEMORY::MAX_MEMORY * sizeof(u32));
+            if (SymbolIndex != nullptr) {
+                memset(SymbolIndex, 0, MEMORY::MAX_MEMORY * sizeof(u32));
+                for (u32 i = 0; i < assembler->SymbolCount; i++) {
+                    const ASSEMBLER::SYMBOL& symbol = assembler->Symbols[i];
+                    if (symbol.Defined && symbol.Value >= 0 && symbol.Value <= 0xFFFF && SymbolIndex[symbol.Value] == 0) {
+                        SymbolIndex[symbol.Value] = i + 1;
+                    }
+                }
+            }
+        }
+    }
+
+    // Label for an address: the assembler's symbol if there is one, L_xxxx for other targets
+    bool Label(Word Address, char* Output, size_t Size) const {
+        if (SymbolIndex != nullptr && SymbolIndex[Address] != 0) {
+            const ASSEMBLER::SYMBOL& symbol = Symbols->Symbols[SymbolIndex[Address] - 1];
+            snprintf(Output, Size, "%.*s", (int)symbol.Length, symbol.Name);
+            return true;
+        }
+        if (IsTarget(Address)) {
+            snprintf(Output, Size, "L_%04X", Address);
+            return true;
+        }
+        return false;
+    }
+
+    // Address the operand of an instruction refers to, false when it refers to none
+    bool OperandAddress(Word Address, const DECODED& decoded, Word& Target) const {
+        const OPCODE& info = InstructionSet->Table[decoded.Opcode];
+        Target = info.Mode == MODE_RELATIVE ? BranchTarget(Address, decoded) : decoded.Operand;
+        return info.Mnemonic != nullptr && info.Mode >= MODE_ZERO_PAGE && info.Mode != MODE_IMMEDIATE;
+    }
+
+    // Whether the listing reaches Address on its own, so a label there gets defined
+    bool Listed(Word Address) const {
+        return Instructions > 0 && Address >= Lowest && Address <= Highest && (!IsCode(Address) || IsStart(Address));
+    }
+
+    // Whether assembling the listed instruction gives back the same opcode. The assembler takes
+    // the first encoding of a mnemonic and narrows operands it already knows to zero page, while
+    // forward references stay absolute.
+    bool Reassembles(Word Address, const DECODED& decoded) const {
+        const OPCODE& info = InstructionSet->Table[decoded.Opcode];
+        if (info.Mnemonic == nullptr) {
+            return true; // Already listed as .byte
+        }
+        s32 key = OPCODE_LOOKUP::Key(info.Mnemonic, 3);
+        s16 row = key < 0 ? -1 : InstructionSet->Lookup.Slots[key];
+        if (row < 0 || InstructionSet->Lookup.Encoding[row][info.Mode] != decoded.Opcode) {
+            return false;
+        }
+        const s16* modes = InstructionSet->Lookup.Encoding[row];
+
+        Byte ZeroPage, Absolute;
+        switch (info.Mode) {
+        case MODE_ZERO_PAGE:
+        case MODE_ABSOLUTE: ZeroPage = MODE_ZERO_PAGE; Absolute = MODE_ABSOLUTE; break;
+        case MODE_ZERO_PAGE_X:
+        case MODE_ABSOLUTE_X: ZeroPage = MODE_ZERO_PAGE_X; Absolute = MODE_ABSOLUTE_X; break;
+        case MODE_ZERO_PAGE_Y:
+        case MODE_ABSOLUTE_Y: ZeroPage = MODE_ZERO_PAGE_Y; Absolute = MODE_ABSOLUTE_Y; break;
+        default: return true;
+        }
+
+        Word Target = decoded.Operand;
+        char Name[48];
+        bool Forward = Label(Target, Name, sizeof(Name)) && Listed(Target) && Target > Address;
+        bool FitsZeroPage = Forward ? modes[Absolute] < 0 : Target <= 0xFF;
+        Byte mode = FitsZeroPage && modes[ZeroPage] >= 0 ? ZeroPage : Absolute;
+        if (Absolute == MODE_ABSOLUTE && modes[MODE_RELATIVE] >= 0) {
+            mode = MODE_RELATIVE;
+        }
+        return mode == info.Mode;
+    }
+
+    // Formats one instruction in assembler syntax, returns its length in bytes
+    u32 Disassemble(const MEMORY& memory, Word Address, char* Output, size_t Size) const {
+        DECODED decoded = Decode(memory, Address);
+        const OPCODE& info = InstructionSet->Table[decoded.Opcode];
+        if (info.Mnemonic == nullptr) {
+            snprintf(Output, Size, ".byte $%02X", decoded.Opcode);
+            return 1;
+        }
+
+        char Operand[48];
+        Word Target;
+        if (!(OperandAddress(Address, decoded, Target) && Label(Target, Operand, sizeof(Operand)))) {
+            snprintf(Operand, sizeof(Operand), ModeLength[info.Mode] == 3 ? "$%04X" : "$%02X", Target);
+        }
+
+        switch (info.Mode) {
+        case MODE_IMPLIED: snprintf(Output, Size, "%s", info.Mnemonic); break;
+        case MODE_ACCUMULATOR: snprintf(Output, Size, "%s A", info.Mnemonic); break;
+        case MODE_IMMEDIATE: snprintf(Output, Size, "%s #$%02X", info.Mnemonic, decoded.Operand); break;
+        case MODE_ZERO_PAGE_X:
+        case MODE_ABSOLUTE_X: snprintf(Output, Size, "%s %s,X", info.Mnemonic, Operand); break;
+        case MODE_ZERO_PAGE_Y:
+        case MODE_ABSOLUTE_Y: snprintf(Output, Size, "%s %s,Y", info.Mnemonic, Operand); break;
+        case MODE_INDIRECT: snprintf(Output, Size, "%s (%s)", info.Mnemonic, Operand); break;
+        case MODE_INDEXED_INDIRECT: snprintf(Output, Size, "%s (%s,X)", info.Mnemonic, Operand); break;
+        case MODE_INDIRECT_INDEXED: snprintf(Output, Size, "%s (%s),Y", info.Mnemonic, Operand); break;
+        case MODE_RELATIVE: snprintf(Output, Size, "%s %s", info.Mnemonic, Operand); break;
+        default: snprintf(Output, Size, "%s %s", info.Mnemonic, Operand); break;
+        }
+        return decoded.Length;
+    }
+
+    // Listing of the analyzed range, code as instructions and anything else as .byte
+    void WriteListing(FILE* Output, const MEMORY& memory) const {
+        if (Instructions == 0) {
+            return;
+        }
+        char Line[64];
+
+        // Names the operands use that no line of the listing defines become constants
+        Byte Defined[MEMORY::MAX_MEMORY / 8] = {};
+        for (u32 Address = Lowest; Address <= Highest; Address++) {
+            Word Target;
+            if (!IsStart(Address) || !Reassembles(Address, Decode(memory, Address))
+                || !OperandAddress(Address, Decode(memory, Address), Target)) {
+                continue;
+            }
+            if (!Listed(Target) && !MEMORY::TestBit(Defined, Target) && Label(Target, Line, sizeof(Line))) {
+                Set(Defined, Target);
+                fprintf(Output, "%s = $%04X\n", Line, Target);
+            }
+        }
+
+        fprintf(Output, "        .org $%04X\n", Lowest);
+        u32 Address = Lowest;
+        while (Address <= Highest) {
+            if (Label(Address, Line, sizeof(Line))) {
+                fprintf(Output, "%s:\n", Line);
+            }
+            else if (IsBlock(Address) && Address != Lowest) {
+                fprintf(Output, "\n");
+            }
+
+            if (IsStart(Address) && Reassembles(Address, Decode(memory, Address))) {
+                Address += Disassemble(memory, Address, Line, sizeof(Line));
+                fprintf(Output, "        %s\n", Line);
+            }
+            else if (IsStart(Address)) {
+                // Kept as bytes so the listing assembles back to the same image
+                u32 Length = Decode(memory, Address).Length;
+                fprintf(Output, "        .byte $%02X", memory[Address]);
+                for (u32 i = 1; i < Length; i++) {
+                    fprintf(Output, ", $%02X", memory[(Word)(Address + i)]);
+                }
+                fprintf(Output, "\n");
+                Address += Length;
+            }
+            else {
+                fprintf(Output, "        .byte $%02X\n", memory[Address]);
+                Address++;
+            }
+        }
+    }
+};
+
+// Device writes travel from the CPU thread to the render thread through this ring. There is
+// one producer and one consumer, so Head and Tail each have a single writer and need no lock.
+struct DEVICE_RING {
+    struct EVENT {
+        Word Address;
+        Byte Value;
+    };
+
+    static constexpr u32 CAPACITY = 1 << 16;
+
+    EVENT Events[CAPACITY];
+    alignas(64) atomic<u32> Head{0};
+    alignas(64) atomic<u32> Tail{0};
+
+    void Push(EVENT event) {
+        u32 head = Head.load(memory_order_relaxed);
+        // Only waits when the renderer has fallen a whole ring behind
+        while (head - Tail.load(memory_order_acquire) == CAPACITY) {
+            this_thread::yield();
+        }
+        Events[head & (CAPACITY - 1)] = event;
+        Head.store(head + 1, memory_order_release);
+    }
+
+    bool Pop(EVENT& event) {
+        u32 tail = Tail.load(memory_order_relaxed);
+        if (tail == Head.load(memory_order_acquire)) {
+            return false;
+        }
+        event = Events[tail & (CAPACITY - 1)];
+        Tail.store(tail + 1, memory_order_release);
+        return true;
+    }
+};
+
+// Headless peripherals. Video is a 32x32 framebuffer at $0200-$05FF holding one palette index
+// per pixel, audio a square wave driven by registers in page $40. The CPU thread only queues
+// the writes, frames (PPM) and sound (WAV) are rendered on a separate thread.
+struct DEVICES {
+    static constexpr Word FRAMEBUFFER = 0x0200;
+    static constexpr u32 WIDTH = 32;
+    static constexpr u32 HEIGHT = 32;
+    static constexpr u32 SAMPLE_RATE = 44100;
+
+    // Registers
+    static constexpr Word
+        AUDIO_FREQUENCY_LOW = 0x4000, // Tone in Hz
+        AUDIO_FREQUENCY_HIGH = 0x4001,
+        AUDIO_VOLUME = 0x4002,
+        AUDIO_PLAY = 0x4003, // Play the tone for this many 60ths of a second
+        VIDEO_PRESENT = 0x4010; // Any write renders the framebuffer as the next frame
+
+    DEVICE_RING Ring;
+    thread Renderer;
+    atomic<bool> Running{false};
+    const char* Prefix;
+
+    // Owned by the render thread
+    Byte Pixels[WIDTH * HEIGHT];
+    bool PixelsChanged;
+    u32 Frames;
+    Word Frequency;
+    Byte Volume;
+    u32 Phase; // 16.16 fraction of the square wave period
+    s16* Samples;
+    u32 SampleCount;
+    u32 SampleCapacity;
+    bool Failed; // A frame or the WAV could not be written
+
+    // Stops the render thread on every way out of the program, not only after a finished run
+    ~DEVICES() {
+        if (Renderer.joinable()) {
+            Detach();
+        }
+    }
+
+    static void Write(void* context, Word address, Byte value) {
+        ((DEVICES*)context)->Ring.Push({ address, value });
+    }
+
+    void Attach(MEMORY& memory, const char* prefix) {
+        Prefix = prefix;
+        memset(Pixels, 0, sizeof(Pixels));
+        PixelsChanged = false;
+        Frames = 0;
+        Frequency = 0;
+        Volume = 0;
+        Phase = 0;
+        Samples = nullptr;
+        SampleCount = SampleCapacity = 0;
+        Failed = false;
+
+        memory.MapDevice(FRAMEBUFFER / MEMORY::PAGE_SIZE, WIDTH * HEIGHT / MEMORY::PAGE_SIZE, Write, this);
+        memory.MapDevice(AUDIO_FREQUENCY_LOW / MEMORY::PAGE_SIZE, 1, Write, this);
+
+        Running = true;
+        Renderer = thread(&DEVICES::Render, this);
+    }
+
+    // Restored or loaded memory never went through Write, so queue what the mapped pages already
+    // hold. Zero bytes match the renderer's reset state and are skipped.
+    void Seed(const MEMORY& memory) {
+        for (u32 i = 0; i < WIDTH * HEIGHT; i++) {
+            if (memory.Data[FRAMEBUFFER + i] != 0) {
+                Ring.Push({ (Word)(FRAMEBUFFER + i), memory.Data[FRAMEBUFFER + i] });
+            }
+        }
+        const Word Registers[] = { AUDIO_FREQUENCY_LOW, AUDIO_FREQUENCY_HIGH, AUDIO_VOLUME };
+        for (Word address : Registers) {
+            if (memory.Data[address] != 0) {
+                Ring.Push({ address, memory.Data[address] });
+            }
+        }
+    }
+
+    // Waits for every queued write to be rendered. Returns false if an output file failed.
+    bool Detach() {
+        Running.store(false, memory_order_release);
+        Renderer.join();
+        free(Samples);
+        Samples = nullptr;
+        return !Failed;
+    }
+
+    void Render() {
+        DEVICE_RING::EVENT event;
+        while (true) {
+            // Checked before draining, so every write queued before Detach is rendered
+            bool Stopping = !Running.load(memory_order_acquire);
+            while (Ring.Pop(event)) {
+                Handle(event);
+            }
+            if (Stopping) {
+                break;
+            }
+            this_thread::sleep_for(chrono::microseconds(200));
+        }
+
+        if (PixelsChanged) {
+            Present();
+        }
+        if (SampleCount > 0) {
+            WriteWav();
+        }
+    }
+
+    void Handle(const DEVICE_RING::EVENT& event) {
+        if (event.Address >= FRAMEBUFFER && event.Address < FRAMEBUFFER + WIDTH * HEIGHT) {
+            Pixels[event.Address - FRAMEBUFFER] = event.Value & 0x0F;
+            PixelsChanged = true;
+            return;
+        }
+
+        switch (event.Address) {
+        case AUDIO_FREQUENCY_LOW: {
+            Frequency = (Frequency & 0xFF00) | event.Value;
+        } break;
+
+        case AUDIO_FREQUENCY_HIGH: {
+            Frequency = (Frequency & 0x00FF) | (event.Value << 8);
+        } break;
+
+        case AUDIO_VOLUME: {
+            Volume = event.Value;
+        } break;
+
+        case AUDIO_PLAY: {
+            Play(event.Value * SAMPLE_RATE / 60);
+        } break;
+
+        case VIDEO_PRESENT: {
+            Present();
+        } break;
+        }
+    }
+
+    void Play(u32 count) {
+        if (SampleCount + count > SampleCapacity) {
+            u32 NewCapacity = SampleCapacity == 0 ? SAMPLE_RATE : SampleCapacity;
+            while (NewCapacity < SampleCount + count) {
+                NewCapacity *= 2;
+            }
+            s16* NewSamples = (s16*)realloc(Samples, NewCapacity * sizeof(s16));
+            if (NewSamples == nullptr) {
+                Failed = true;
+                return;
+            }
+            Samples = NewSamples;
+            SampleCapacity = NewCapacity;
+        }
+
+        u32 Step = (u32)(((u64)Frequency << 16) / SAMPLE_RATE);
+        s16 Amplitude = Frequency == 0 ? 0 : Volume * 64;
+        for (u32 i = 0; i < count; i++) {
+            Samples[SampleCount++] = (Phase & 0x8000) ? -Amplitude : Amplitude;
+            Phase = (Phase + Step) & 0xFFFF;
+        }
+    }
+
+    void Present() {
+        // 16 colour palette, as RGB
+        static const Byte Palette[16][3] = {
+            { 0x00, 0x00, 0x00 }, { 0xFF, 0xFF, 0xFF }, { 0x88, 0x00, 0x00 }, { 0xAA, 0xFF, 0xEE },
+            { 0xCC, 0x44, 0xCC }, { 0x00, 0xCC, 0x55 }, { 0x00, 0x00, 0xAA }, { 0xEE, 0xEE, 0x77 },
+            { 0xDD, 0x88, 0x55 }, { 0x66, 0x44, 0x00 }, { 0xFF, 0x77, 0x77 }, { 0x33, 0x33, 0x33 },
+            { 0x77, 0x77, 0x77 }, { 0xAA, 0xFF, 0x66 }, { 0x00, 0x88, 0xFF }, { 0xBB, 0xBB, 0xBB },
+        };
+
+        char Name[256];
+        snprintf(Name, sizeof(Name), "%s_frame_%04u.ppm", Prefix, Frames++);
+        FILE* Frame = fopen(Name, "wb");
+        if (Frame == nullptr) {
+            Failed = true;
+            return;
+        }
+        fprintf(Frame, "P6\n%u %u\n255\n", WIDTH, HEIGHT);
+        for (u32 i = 0; i < WIDTH * HEIGHT; i++) {
+            fwrite(Palette[Pixels[i]], 1, 3, Frame);
+        }
+        fclose(Frame);
+        PixelsChanged = false;
+    }
+
+    static void Put(FILE* Output, u32 value, u32 bytes) {
+        for (u32 i = 0; i < bytes; i++) {
+            fputc((value >> (8 * i)) & 0xFF, Output);
+        }
+    }
+
+    // 16 bit mono PCM
+    void WriteWav() {
+        char Name[256];
+        snprintf(Name, sizeof(Name), "%s.wav", Prefix);
+        FILE* Wav = fopen(Name, "wb");
+        if (Wav == nullptr) {
+            Failed = true;
+            return;
+        }
+        u32 DataSize = SampleCount * sizeof(s16);
+        fwrite("RIFF", 1, 4, Wav);
+        Put(Wav, 36 + DataSize, 4);
+        fwrite("WAVEfmt ", 1, 8, Wav);
+        Put(Wav, 16, 4); // Format chunk size
+        Put(Wav, 1, 2); // PCM
+        Put(Wav, 1, 2); // Channels
+        Put(Wav, SAMPLE_RATE, 4);
+        Put(Wav, SAMPLE_RATE * sizeof(s16), 4); // Bytes per second
+        Put(Wav, sizeof(s16), 2); // Block align
+        Put(Wav, 16, 2); // Bits per sample
+        fwrite("data", 1, 4, Wav);
+        Put(Wav, DataSize, 4);
+        for (u32 i = 0; i < SampleCount; i++) {
+            Put(Wav, (u16)Samples[i], 2);
+        }
+        fclose(Wav);
+    }
+};
+
+// Edge coverage of one fuzz worker. Every opcode fetch marks the edge from the previous
+// instruction, hashed into a 64K map like AFL does. Only touched entries are cleared
+// between runs.
+struct COVERAGE {
+    static constexpr u32 SIZE = 1 << 16;
+
+    Byte Edges[SIZE];
+    Word Touched[SIZE];
+    u32 TouchedCount;
+    Word Previous;
+
+    void Clear() {
+        for (u32 i = 0; i < TouchedCount; i++) {
+            Edges[Touched[i]] = 0;
+        }
+        TouchedCount = 0;
+        Previous = 0;
+    }
+
+    void Visit(Word address) {
+        Word location = (Word)((address * 2654435761u) >> 16);
+        Word edge = location ^ Previous;
+        if (Edges[edge] == 0) {
+            Edges[edge] = 1;
+            Touched[TouchedCount++] = edge;
+        }
+        Previous = location >> 1;
+    }
+};
+
+// Instruction stepped like FAST_BUS, and records edges into the COVERAGE attached as the
+// memory's listener context
+struct COVERAGE_BUS {
+    static void Cycle(MEMORY& memory, Word address, Byte, Byte kind) {
+        if (kind == MEMORY::BUS_OPCODE) {
+            ((COVERAGE*)memory.ListenerContext)->Visit(address);
+        }
+    }
+};
+
+// Engines of a CPU variant, one per bus policy. A run picks its engine once and calls through
+// it per Execute slice.
+struct VARIANT {
+    const char* Name;
+    const INSTRUCTION_SET* Instructions;
+    s32 (*Fast)(CPU6502&, s32, MEMORY&);
+    s32 (*CycleExact)(CPU6502&, s32, MEMORY&);
+    s32 (*Coverage)(CPU6502&, s32, MEMORY&);
+};
+
+template <typename Bus, typename Variant>
+s32 Engine(CPU6502& cpu, s32 ticks, MEMORY& memory) {
+    return cpu.Execute<Bus, Variant>(ticks, memory);
+}
+
+static const VARIANT Variants[] = {
+    { "6502", &NmosInstructions,
+        Engine<FAST_BUS, NMOS>, Engine<CYCLE_BUS, NMOS>, Engine<COVERAGE_BUS, NMOS> },
+    { "6502-undocumented", &UndocumentedInstructions,
+        Engine<FAST_BUS, NMOS_UNDOCUMENTED>, Engine<CYCLE_BUS, NMOS_UNDOCUMENTED>, Engine<COVERAGE_BUS, NMOS_UNDOCUMENTED> },
+    { "65c02", &Cmos65C02Instructions,
+        Engine<FAST_BUS, CMOS_65C02>, Engine<CYCLE_BUS, CMOS_65C02>, Engine<COVERAGE_BUS, CMOS_65C02> },
+};
+
+const VARIANT* FindVariant(const char* name) {
+    for (const VARIANT& variant : Variants) {
+        if (strcmp(variant.Name, name) == 0) {
+            return &variant;
+        }
+    }
+    return nullptr;
+}
+
+// In-process fuzzer. Every worker thread owns a copy of the prepared machine, writes a
+// mutated input into the input region, runs to the stop address or the tick budget and rolls
+// memory back through its journal. Workers keep inputs that found edges neither they nor the
+// shared coverage have seen. The shared coverage only changes at barriers every MERGE_EVERY
+// runs, where the workers' new edges are merged in worker order, so the runs of every worker
+// depend only on the seed.
+struct FUZZER {
+    struct WORKER {
+        MEMORY memory;
+        CPU6502 cpu;
+        JOURNAL journal;
+        COVERAGE coverage;
+        Byte Seen[COVERAGE::SIZE];
+        Word Fresh[COVERAGE::SIZE]; // Seen since the last merge
+        u32 FreshCount;
+        Byte* Corpus;
+        u32 CorpusCount;
+        u64 Random;
+        u64 Execs;
+        u64 Stops[4]; // By CPU6502::STOP_*
+    };
+
+    static constexpr u32 CORPUS_CAPACITY = 4096;
+    static constexpr u32 MERGE_EVERY = 4096;
+
+    // Configuration
+    const VARIANT* Variant;
+    const MEMORY* Base;
+    const CPU6502* BaseCpu;
+    Word InputAddress;
+    u32 InputLength;
+    s32 Ticks;
+    u64 Iterations; // Per worker
+    u64 Seed;
+
+    WORKER* Workers;
+    u32 WorkerCount;
+
+    // Barrier between rounds
+    mutex Lock;
+    condition_variable Merged;
+    u32 Arrived;
+    u32 Round;
+
+    Byte Global[COVERAGE::SIZE]; // Read only while a round runs
+    u32 GlobalEdges;
+
+    // Workers only start fuzzing once all of them are set up, so the allocation count of the
+    // fuzzing itself can be told apart from thread start up
+    atomic<u32> Ready;
+    atomic<bool> Go;
+    u64 Allocations; // Heap allocations while fuzzing
+
+    // xorshift64*
+    static u64 Next(u64& state) {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 2685821657736338717ull;
+    }
+
+    void Mutate(WORKER& worker, Byte* input) {
+        static const Byte Interesting[] = { 0x00, 0x01, 0x7F, 0x80, 0xFF };
+        u32 count = 1 + Next(worker.Random) % 4;
+        for (u32 i = 0; i < count; i++) {
+            u64 r = Next(worker.Random);
+            u32 at = (r >> 8) % InputLength;
+            switch (r % 4) {
+            case 0: input[at] ^= 1 << ((r >> 40) % 8); break;
+            case 1: input[at] = r >> 32; break;
+            case 2: input[at] += (Byte)((r >> 32) % 35) - 17; break;
+            default: input[at] = Interesting[(r >> 32) % sizeof(Interesting)]; break;
+            }
+        }
+    }
+
+    void Prepare(WORKER& worker) {
+        worker.memory = *Base;
+        worker.memory.AttachJournal(&worker.journal);
+        worker.memory.Listener = nullptr;
+        worker.memory.ListenerContext = &worker.coverage;
+    }
+
+    // Waits for every worker to finish the round, the last one to arrive merges for all
+    void Merge() {
+        unique_lock<mutex> guard(Lock);
+        u32 round = Round;
+        if (++Arrived < WorkerCount) {
+            Merged.wait(guard, [&] { return Round != round; });
+            return;
+        }
+
+        for (u32 w = 0; w < WorkerCount; w++) {
+            WORKER& worker = Workers[w];
+            for (u32 i = 0; i < worker.FreshCount; i++) {
+                if (Global[worker.Fresh[i]] == 0) {
+                    Global[worker.Fresh[i]] = 1;
+                    GlobalEdges++;
+                }
+            }
+            worker.FreshCount = 0;
+        }
+        Arrived = 0;
+        Round++;
+        Merged.notify_all();
+    }
+
+    void Work(WORKER& worker, u32 index) {
+        METRICS_SHARD& shard = Metrics.Local();
+        worker.Random = Seed * 0x9E3779B97F4A7C15ull + index + 1;
+        worker.coverage.TouchedCount = 0;
+        worker.FreshCount = 0;
+        worker.Execs = 0;
+        memset(worker.Seen, 0, sizeof(worker.Seen));
+        memset(worker.Stops, 0, sizeof(worker.Stops));
+
+        // The input region as loaded is the first corpus entry
+        memcpy(worker.Corpus, Base->Data + InputAddress, InputLength);
+        worker.CorpusCount = 1;
+
+        Prepare(worker);
+        u64 mark = worker.journal.Mark();
+        Byte* input = worker.Corpus + CORPUS_CAPACITY * InputLength;
+
+        Ready++;
+        while (!Go) {
+            this_thread::yield();
+        }
+
+        for (u64 i = 0; i < Iterations; i++) {
+            u64 Start = Nanoseconds();
+            memcpy(input, worker.Corpus + (Next(worker.Random) % worker.CorpusCount) * InputLength, InputLength);
+            Mutate(worker, input);
+            for (u32 j = 0; j < InputLength; j++) {
+                worker.memory.Store(InputAddress + j, input[j]);
+            }
+
+            worker.cpu = *BaseCpu;
+            worker.coverage.Clear();
+            Variant->Coverage(worker.cpu, Ticks, worker.memory);
+            worker.Stops[worker.cpu.stop_reason]++;
+            worker.Execs++;
+
+            bool Found = false;
+            for (u32 j = 0; j < worker.coverage.TouchedCount; j++) {
+                Word edge = worker.coverage.Touched[j];
+                if (worker.Seen[edge] == 0 && Global[edge] == 0) {
+                    worker.Seen[edge] = 1;
+                    worker.Fresh[worker.FreshCount++] = edge;
+                    Found = true;
+                }
+            }
+            if (Found && worker.CorpusCount < CORPUS_CAPACITY) {
+                memcpy(worker.Corpus + worker.CorpusCount++ * InputLength, input, InputLength);
+            }
+
+            // A run that outgrew the journal falls back to copying the whole machine
+            if (!worker.memory.Rollback(mark)) {
+                Prepare(worker);
+                mark = worker.journal.Mark();
+            }
+            shard.JobNanoseconds.Record(Nanoseconds() - Start);
+            if ((i + 1) % MERGE_EVERY == 0 || i + 1 == Iterations) {
+                Merge();
+            }
+        }
+    }
+
+    // Returns false when the workers could not be set up
+    bool Run(u32 WorkerCount, FILE* CorpusOutput) {
+        memset(Global, 0, sizeof(Global));
+        GlobalEdges = 0;
+        Arrived = 0;
+        Round = 0;
+
+        WORKER* workers = new WORKER[WorkerCount];
+        Workers = workers;
+        this->WorkerCount = WorkerCount;
+        thread* threads = new thread[WorkerCount];
+        bool ok = true;
+        for (u32 i = 0; i < WorkerCount; i++) {
+            workers[i].Corpus = (Byte*)malloc((CORPUS_CAPACITY + 1) * InputLength);
+            ok &= workers[i].Corpus != nullptr && workers[i].journal.Initialize(1 << 16);
+        }
+
+        Ready = 0;
+        Go = false;
+        for (u32 i = 0; i < WorkerCount && ok; i++) {
+            threads[i] = thread(&FUZZER::Work, this, ref(workers[i]), i);
+        }
+        while (ok && Ready < WorkerCount) {
+            this_thread::yield();
+        }
+        u64 AllocationsBefore = HeapAllocations.load();
+        u64 Start = Nanoseconds();
+        Go = true;
+        for (u32 i = 0; i < WorkerCount && ok; i++) {
+            threads[i].join();
+        }
+        Allocations = HeapAllocations.load() - AllocationsBefore;
+        double Seconds = (Nanoseconds() - Start) / 1e9;
+
+        if (ok) {
+            u64 Execs = 0, Stops[4] = {};
+            u32 Corpus = 0;
+            for (u32 i = 0; i < WorkerCount; i++) {
+                Execs += workers[i].Execs;
+                Corpus += workers[i].CorpusCount;
+                for (u32 j = 0; j < 4; j++) {
+                    Stops[j] += workers[i].Stops[j];
+                }
+                for (u32 j = 0; CorpusOutput != nullptr && j < workers[i].CorpusCount; j++) {
+                    for (u32 k = 0; k < InputLength; k++) {
+                        fprintf(CorpusOutput, "%02X", workers[i].Corpus[j * InputLength + k]);
+                    }
+                    fputc('\n', CorpusOutput);
+                }
+            }
+            printf("Fuzzed %llu execs on %u workers in %.3f s: %.0f execs/s\n", Execs, WorkerCount, Seconds, Execs / Seconds);
+            printf("Edges: %u, corpus: %u\n", GlobalEdges, Corpus);
+            printf("Stops: %llu budget, %llu pc range, %llu stop address, %llu watchpoint\n", Stops[0], Stops[1], Stops[2], Stops[3]);
+        }
+
+        for (u32 i = 0; i < WorkerCount; i++) {
+            free(workers[i].Corpus);
+        }
+        delete[] threads;
+        delete[] workers;
+        return ok;
+    }
+};
+
+// On-disk machine state. The file holds two slots of the same fixed layout, a header followed
+// by every memory page. Checkpoints alternate between the slots, so the previous checkpoint
+// stays intact while the next one is written, and a checkpoint only rewrites the pages that
+// changed since its slot was last written.
+struct SAVESTATE_HEADER {
+    char Magic[4];
+    u32 Version;
+    u64 Generation; // The valid slot with the highest generation is the current state
+    u64 cycles;
+    s32 ticks; // Remaining tick budget of the interrupted run
+    Word program_counter;
+    Word stack_pointer;
+    Byte a, x, y;
+    Byte flags; // Packed NV-BDIZC
+    Word code_floor;
+    Word Reserved;
+    u32 PageChecksums[MEMORY::PAGE_COUNT];
+    u32 HeaderChecksum; // Covers everything above, written last
+};
+
+static_assert(sizeof(SAVESTATE_HEADER) == 1072, "Save-state header layout changed, bump VERSION");
+
+struct SAVESTATE {
+    static constexpr u32 VERSION = 3;
+    static constexpr u32 PAGES_OFFSET = sizeof(SAVESTATE_HEADER);
+    static constexpr u32 SLOT_SIZE = PAGES_OFFSET + MEMORY::MAX_MEMORY;
+    static constexpr u32 FILE_SIZE = 2 * SLOT_SIZE;
+
+    SAVESTATE_HEADER Header; // Of the current slot
+    int File = -1;
+    Byte* Mapping = nullptr;
+    s32 Current = -1; // Slot memory was last checkpointed to or restored from
+    bool Synced = false; // Memory equals the current slot except for its dirty pages
+    bool Stale[2][MEMORY::PAGE_COUNT] = {}; // Page of a slot is older than memory at the last sync
+
+    ~SAVESTATE() {
+        Close();
+    }
+
+    void Close() {
+        if (Mapping != nullptr) {
+            munmap(Mapping, FILE_SIZE);
+            Mapping = nullptr;
+        }
+        if (File >= 0) {
+            close(File);
+            File = -1;
+        }
+        Current = -1;
+        Synced = false;
+    }
+
+    static u32 HeaderChecksum(const SAVESTATE_HEADER& header) {
+        return Checksum((const Byte*)&header, offsetof(SAVESTATE_HEADER, HeaderChecksum));
+    }
+
+    const SAVESTATE_HEADER* SlotHeader(u32 slot) const {
+        return (const SAVESTATE_HEADER*)(Mapping + slot * SLOT_SIZE);
+    }
+
+    const Byte* SlotPage(u32 slot, u32 page) const {
+        return Mapping + slot * SLOT_SIZE + PAGES_OFFSET + page * MEMORY::PAGE_SIZE;
+    }
+
+    bool ValidHeader(u32 slot) const {
+        const SAVESTATE_HEADER* header = SlotHeader(slot);
+        return memcmp(header->Magic, "XSAV", 4) == 0 && header->Version == VERSION
+            && header->HeaderChecksum == HeaderChecksum(*header);
+    }
+
+    // Slots with a valid header, newest first
+    u32 Candidates(s32* slots) const {
+        u32 count = 0;
+        for (u32 slot = 0; slot < 2; slot++) {
+            if (ValidHeader(slot)) {
+                slots[count++] = slot;
+            }
+        }
+        if (count == 2 && SlotHeader(1)->Generation > SlotHeader(0)->Generation) {
+            slots[0] = 1;
+            slots[1] = 0;
+        }
+        return count;
+    }
+
+    bool Open(const char* FileName) {
+        Close();
+        File = open(FileName, O_RDWR);
+        if (File < 0) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(File, &info) != 0 || info.st_size != FILE_SIZE) {
+            Close();
+            return false;
+        }
+
+        return Map();
+    }
+
+    // Opens or creates the file without discarding it, the first checkpoint goes to the slot
+    // that does not hold the newest valid state
+    bool Create(const char* FileName) {
+        Close();
+        File = open(FileName, O_RDWR | O_CREAT, 0644);
+        if (File < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(File, &info) != 0 || (info.st_size != FILE_SIZE && ftruncate(File, FILE_SIZE) != 0)) {
+            Close();
+            return false;
+        }
+        if (!Map()) {
+            return false;
+        }
+
+        s32 slots[2];
+        memset(&Header, 0, sizeof(Header));
+        if (Candidates(slots) > 0) {
+            Current = slots[0];
+            Header.Generation = SlotHeader(Current)->Generation;
+        }
+        return true;
+    }
+
+    bool Map() {
+        void* mapped = mmap(nullptr, FILE_SIZE, PROT_READ, MAP_SHARED, File, 0);
+        if (mapped == MAP_FAILED) {
+            Close();
+            return false;
+        }
+        Mapping = (Byte*)mapped;
+        return true;
+    }
+
+    // Writes the pages of the other slot that differ from memory, then commits them by writing
+    // that slot's header with the next generation
+    bool Checkpoint(const CPU6502& cpu, MEMORY& memory, s32 ticks) {
+        if (File < 0) {
+            return false;
+        }
+
+        u32 slot = Current == 0 ? 1 : 0;
+        u64 Base = (u64)slot * SLOT_SIZE;
+        SAVESTATE_HEADER Next = Header;
+        for (u32 page = 0; page < MEMORY::PAGE_COUNT; page++) {
+            bool Dirty = !Synced || (memory.PageFlags[page] & MEMORY::PAGE_DIRTY);
+            if (!Dirty && !Stale[slot][page]) {
+                continue;
+            }
+            const Byte* Data = memory.Data + page * MEMORY::PAGE_SIZE;
+            Next.PageChecksums[page] = Checksum(Data, MEMORY::PAGE_SIZE);
+            if (pwrite(File, Data, MEMORY::PAGE_SIZE, Base + PAGES_OFFSET + page * MEMORY::PAGE_SIZE) != (ssize_t)MEMORY::PAGE_SIZE) {
+                return false;
+            }
+        }
+
+        memcpy(Next.Magic, "XSAV", 4);
+        Next.Version = VERSION;
+        Next.Generation = Header.Generation + 1;
+        Next.cycles = cpu.cycles;
+        Next.ticks = ticks;
+        Next.program_counter = cpu.program_counter;
+        Next.stack_pointer = cpu.stack_pointer;
+        Next.a = cpu.a;
+        Next.x = cpu.x;
+        Next.y = cpu.y;
+        Next.flags = cpu.PackFlags();
+        Next.code_floor = cpu.code_floor;
+        Next.Reserved = 0;
+        Next.HeaderChecksum = HeaderChecksum(Next);
+
+        // Pages must be on disk before the header that vouches for them
+        if (fdatasync(File) != 0) {
+            return false;
+        }
+        if (pwrite(File, &Next, sizeof(Next), Base) != (ssize_t)sizeof(Next) || fdatasync(File) != 0) {
+            return false;
+        }
+
+        // The slot now equals memory, the other one still misses what changed since the last sync
+        for (u32 page = 0; page < MEMORY::PAGE_COUNT; page++) {
+            bool Dirty = !Synced || (memory.PageFlags[page] & MEMORY::PAGE_DIRTY);
+            Stale[1 - slot][page] = Dirty || Stale[1 - slot][page];
+            Stale[slot][page] = false;
+        }
+        Header = Next;
+        Current = slot;
+        memory.ClearDirty();
+        Synced = true;
+        return true;
+    }
+
+    // Copies the newest checkpoint whose pages verify back, falling back to the older slot.
+    // When memory is still in sync with that slot only the pages dirtied since are copied.
+    bool Restore(CPU6502& cpu, MEMORY& memory, s32& ticks) {
+        if (Mapping == nullptr) {
+            return false;
+        }
+
+        s32 slots[2];
+        u32 count = Candidates(slots);
+        for (u32 i = 0; i < count; i++) {
+            u32 slot = slots[i];
+            bool Incremental = Synced && Current == (s32)slot;
+            const SAVESTATE_HEADER* Saved = SlotHeader(slot);
+
+            bool Valid = true;
+            for (u32 page = 0; page < MEMORY::PAGE_COUNT && Valid; page++) {
+                if (Incremental && !(memory.PageFlags[page] & MEMORY::PAGE_DIRTY)) {
+                    continue;
+                }
+                Valid = Checksum(SlotPage(slot, page), MEMORY::PAGE_SIZE) == Saved->PageChecksums[page];
+            }
+            if (!Valid) {
+                continue;
+            }
+
+            for (u32 page = 0; page < MEMORY::PAGE_COUNT; page++) {
+                if (Incremental && !(memory.PageFlags[page] & MEMORY::PAGE_DIRTY)) {
+                    continue;
+                }
+                memcpy(memory.Data + page * MEMORY::PAGE_SIZE, SlotPage(slot, page), MEMORY::PAGE_SIZE);
+            }
+
+            memcpy(&Header, Saved, sizeof(Header));
+            for (u32 page = 0; page < MEMORY::PAGE_COUNT; page++) {
+                Stale[slot][page] = false;
+                Stale[1 - slot][page] = true;
+            }
+
+            cpu.cycles = Header.cycles;
+            cpu.program_counter = Header.program_counter;
+            cpu.stack_pointer = Header.stack_pointer;
+            cpu.a = Header.a;
+            cpu.x = Header.x;
+            cpu.y = Header.y;
+            cpu.UnpackFlags(Header.flags);
+            cpu.code_floor = Header.code_floor;
+            ticks = Header.ticks;
+
+            Current = slot;
+            memory.ClearDirty();
+            Synced = true;
+            return true;
+        }
+        Synced = false;
+        return false;
+    }
+};
+
+// Writes one line per bus cycle of a cycle exact run
+struct BUS_TRACE {
+    FILE* Output;
+    u64 cycle;
+
+    static void Cycle(void* context, Word address, Byte data, Byte kind) {
+        static const char* Kinds[] = { "opcode", "read", "write", "dummy-read", "dummy-write" };
+        BUS_TRACE* trace = (BUS_TRACE*)context;
+        fprintf(trace->Output, "%llu $%04X $%02X %s\n", trace->cycle++, address, data, Kinds[kind]);
+    }
+};
+
+// Assembles a generated source of the given size and reports the throughput
+int BenchmarkAssembler(u32 megabytes, MEMORY& memory, ARENA& arena) {
+    static const char* Block =
+        "loop%u: LDA $10,X\n"
+        "  STA buffer%u,Y\n"
+        "  LDX #<buffer%u + $20\n"
+        "  ADC ($20),Y\n"
+        "  BNE loop%u\n"
+        "  JMP next%u\n"
+        "  .byte $01, %%1010, 'z'\n"
+        "next%u: JSR loop%u\n";
+
+    size_t Size = (size_t)megabytes * 1024 * 1024;
+    char* Source = (char*)arena.Allocate(Size + 256);
+    if (Source == nullptr) {
+        printf("Benchmark source does not fit in the arena. Exit");
+        return 4;
+    }
+
+    // Restart at a new origin before a chunk could run off the end of memory
+    size_t Length = 0;
+    for (u32 block = 0; Length < Size; block++) {
+        if (block % 1024 == 0) {
+            Length += snprintf(Source + Length, 256, ".org $1000\nbuffer%u: .word 0\n", block);
+        }
+        u32 chunk = block - block % 1024;
+        Length += snprintf(Source + Length, 256, Block, block, chunk, chunk, block, block, block, block);
+    }
+
+    timespec Start, End;
+    ASSEMBLER assembler;
+    clock_gettime(CLOCK_MONOTONIC, &Start);
+    bool ok = assembler.Assemble(Source, 0, memory, arena);
+    clock_gettime(CLOCK_MONOTONIC, &End);
+    if (!ok) {
+        printf("Benchmark failed: %s. Exit", assembler.Error);
+        return 3;
+    }
+
+    double Seconds = (End.tv_sec - Start.tv_sec) + (End.tv_nsec - Start.tv_nsec) / 1e9;
+    printf("Assembled %.1f MiB, %u symbols, %u fixups in %.3f s: %.1f MiB/s\n",
+        Length / 1048576.0, assembler.SymbolCount, assembler.FixupCount, Seconds, Length / 1048576.0 / Seconds);
+    return 0;
+}
+
+// For --check-allocations, count is the number of operator new calls the job made
+bool NoAllocations(u64 count) {
+    if (count != 0) {
+        printf("Run made %llu heap allocations. Exit", count);
+        return false;
+    }
+    return true;
+}
+
+bool WriteMetrics(const char* path) {
+    FILE* Output = fopen(path, "w");
+    if (Output == nullptr) {
+        printf("Could not write the metrics to %s. Exit", path);
+        return false;
+    }
+    Metrics.Write(Output);
+    fclose(Output);
+    return true;
+}
+
+// Runs the loaded program up to the entry point once, then fuzzes from that snapshot
+int Fuzz(const VARIANT& variant, CPU6502& cpu, MEMORY& memory, s32 ticks, u32 workers, u64 iterations, u64 seed,
+    s32 InputAddress, s32 InputLength, s32 Stop, s32 Entry, const char* CorpusPath, bool devices, bool CheckAllocations) {
+    if (devices) {
+        printf("Devices cannot be used while fuzzing. Exit");
+        return 2;
+    }
+    if (InputAddress < 0 || InputLength <= 0 || InputAddress + InputLength > (s32)MEMORY::MAX_MEMORY) {
+        printf("--fuzz needs --fuzz-input address length inside memory. Exit");
+        return 2;
+    }
+
+    if (Entry >= 0) {
+        memory.SetBreakpoint(Entry);
+        while (ticks > 0 && cpu.program_counter != Entry) {
+            ticks = variant.Fast(cpu, ticks, memory);
+            if (cpu.stop_reason != CPU6502::STOP_BREAKPOINT || cpu.program_counter == Entry) {
+                break;
+            }
+        }
+        memory.SetBreakpoint(Entry, false);
+        if (cpu.program_counter != Entry) {
+            printf("Program never reached the fuzz entry %d. Exit", Entry);
+            return 1;
+        }
+    }
+    if (Stop >= 0) {
+        memory.SetBreakpoint(Stop);
+    }
+    cpu.report_unhandled = false;
+
+    FILE* Corpus = nullptr;
+    if (CorpusPath != nullptr && (Corpus = fopen(CorpusPath, "w")) == nullptr) {
+        printf("Could not create %s. Exit", CorpusPath);
+        return 4;
+    }
+
+    FUZZER* fuzzer = new FUZZER;
+    fuzzer->Variant = &variant;
+    fuzzer->Base = &memory;
+    fuzzer->BaseCpu = &cpu;
+    fuzzer->InputAddress = InputAddress;
+    fuzzer->InputLength = InputLength;
+    fuzzer->Ticks = ticks;
+    fuzzer->Iterations = iterations;
+    fuzzer->Seed = seed;
+    bool ok = fuzzer->Run(workers, Corpus);
+    u64 Allocations = fuzzer->Allocations;
+    delete fuzzer;
+
+    if (Corpus != nullptr) {
+        fclose(Corpus);
+    }
+    if (!ok) {
+        printf("Could not set up the fuzz workers. Exit");
+        return 4;
+    }
+    if (CheckAllocations && !NoAllocations(Allocations)) {
+        return 5;
+    }
+    return 0;
+}
+
+// Static, so it is aligned for its ring and outlives every return from main
+static DEVICES Devices;
+
+int main(int argc, char* argv[]) {
+    const char* SavePath = nullptr;
+    const char* RestorePath = nullptr;
+    s32 CheckpointEvery = 0;
+    bool CheckAllocations = false;
+    const char* DeltaPath = nullptr;
+    const char* AssemblyPath = nullptr;
+    const char* SymbolsPath = nullptr;
+    s32 TickBudget = 0;
+    u32 BenchmarkMegabytes = 0;
+    bool CycleExact = false;
+    const char* ListingPath = nullptr;
+    const char* DevicesPrefix = nullptr;
+    const char* MetricsPath = nullptr;
+    const char* VariantName = "6502";
+    u32 FuzzWorkers = 0;
+    u64 FuzzIterations = 100000;
+    u64 FuzzSeed = 1;
+    s32 FuzzInputAddress = -1, FuzzInputLength = 0, FuzzStop = -1, FuzzEntry = -1;
+    const char* CorpusPath = nullptr;
+    const char* BusTracePath = nullptr;
+    u64 JournalSize = 0;
+    Word Breaks[16], ReadWatches[16], WriteWatches[16];
+    int BreakCount = 0, ReadWatchCount = 0, WriteWatchCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--save") == 0 && i + 1 < argc) {
+            SavePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--restore") == 0 && i + 1 < argc) {
+            RestorePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--checkpoint-every") == 0 && i + 1 < argc) {
+            CheckpointEvery = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--asm") == 0 && i + 1 < argc) {
+            AssemblyPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--symbols") == 0 && i + 1 < argc) {
+            SymbolsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc) {
+            TickBudget = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bench-asm") == 0 && i + 1 < argc) {
+            BenchmarkMegabytes = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--cycle-exact") == 0) {
+            CycleExact = true;
+        }
+        else if (strcmp(argv[i], "--bus-trace") == 0 && i + 1 < argc) {
+            BusTracePath = argv[++i];
+            CycleExact = true;
+        }
+        else if (strcmp(argv[i], "--fuzz") == 0 && i + 1 < argc) {
+            FuzzWorkers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--fuzz-iterations") == 0 && i + 1 < argc) {
+            FuzzIterations = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz-seed") == 0 && i + 1 < argc) {
+            FuzzSeed = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz-input") == 0 && i + 2 < argc) {
+            FuzzInputAddress = strtol(argv[++i], nullptr, 0);
+            FuzzInputLength = strtol(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz-stop") == 0 && i + 1 < argc) {
+            FuzzStop = strtol(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz-entry") == 0 && i + 1 < argc) {
+            FuzzEntry = strtol(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--fuzz-corpus") == 0 && i + 1 < argc) {
+            CorpusPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--variant") == 0 && i + 1 < argc) {
+            VariantName = argv[++i];
+        }
+        else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            MetricsPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--devices") == 0 && i + 1 < argc) {
+            DevicesPrefix = argv[++i];
+        }
+        else if (strcmp(argv[i], "--disasm") == 0 && i + 1 < argc) {
+            ListingPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            JournalSize = strtoull(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--delta") == 0 && i + 1 < argc) {
+            DeltaPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--check-allocations") == 0) {
+            CheckAllocations = true;
+        }
+        else if (strcmp(argv[i], "--break") == 0 && i + 1 < argc && BreakCount < 16) {
+            Breaks[BreakCount++] = strtol(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--watch-read") == 0 && i + 1 < argc && ReadWatchCount < 16) {
+            ReadWatches[ReadWatchCount++] = strtol(argv[++i], nullptr, 0);
+        }
+        else if (strcmp(argv[i], "--watch-write") == 0 && i + 1 < argc && WriteWatchCount < 16) {
+            WriteWatches[WriteWatchCount++] = strtol(argv[++i], nullptr, 0);
+        }
+        else {
+            printf("Usage: %s [--restore file] [--save file] [--checkpoint-every ticks]"
+                " [--check-allocations] [--journal entries] [--delta file]"
+                " [--asm file] [--symbols file] [--ticks ticks] [--bench-asm megabytes]"
+                " [--cycle-exact] [--bus-trace file] [--disasm file] [--devices prefix]"
+                " [--metrics file] [--fuzz workers] [--fuzz-iterations n] [--fuzz-seed n]"
+                " [--fuzz-input address length] [--fuzz-stop address] [--fuzz-entry address] [--fuzz-corpus file]"
+                " [--variant 6502|6502-undocumented|65c02]"
+                " [--break address] [--watch-read address] [--watch-write address]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const VARIANT* variant = FindVariant(VariantName);
+    if (variant == nullptr) {
+        printf("Unknown CPU variant %s. Exit", VariantName);
+        return 2;
+    }
+
+    MEMORY memory;
+    CPU6502 cpu;
+    JOURNAL journal;
+
+    if (DeltaPath != nullptr && JournalSize == 0) {
+        JournalSize = 1 << 20;
+    }
+    if (JournalSize > 0) {
+        if (!journal.Initialize(JournalSize)) {
+            printf("Could not reserve the journal. Exit");
+            return 4;
+        }
+        memory.AttachJournal(&journal);
+    }
+    cpu.Reset(memory);
+
+    ARENA arena;
+    if (!arena.Initialize(ARENA::DEFAULT_CAPACITY)) {
+        printf("Could not reserve the arena. Exit");
+        return 4;
+    }
+
+    // Started before the run so the render thread is not counted as a job allocation
+    DEVICES* devices = nullptr;
+    if (DevicesPrefix != nullptr) {
+        devices = &Devices;
+        devices->Attach(memory, DevicesPrefix);
+    }
+
+    METRICS_SHARD& shard = Metrics.Local();
+    u64 AllocationsBefore = HeapAllocations.load();
+
+    if (BenchmarkMegabytes > 0) {
+        int result = BenchmarkAssembler(BenchmarkMegabytes, memory, arena);
+        if (result == 0 && CheckAllocations && !NoAllocations(HeapAllocations.load() - AllocationsBefore)) {
+            return 5;
+        }
+        return result;
+    }
+
+    SAVESTATE state;
+    ASSEMBLER assembler;
+    bool Assembled = false;
+    s32 ticks;
+
+    if (RestorePath != nullptr) {
+        u64 Start = Nanoseconds();
+        if (!state.Open(RestorePath) || !state.Restore(cpu, memory, ticks)) {
+            printf("Could not restore %s. Exit", RestorePath);
+            return 4;
+        }
+        shard.RestoreNanoseconds.Record(Nanoseconds() - Start);
+    }
+    else if (AssemblyPath != nullptr) {
+        char* source = cpu.ReadFileInstructions(AssemblyPath, arena);
+        if (source == nullptr) {
+            printf("Could not read %s. Exit", AssemblyPath);
+            return 4;
+        }
+        assembler.InstructionSet = variant->Instructions;
+        if (!assembler.Assemble(source, cpu.program_counter, memory, arena)) {
+            printf("%s: %s. Exit", AssemblyPath, assembler.Error);
+            return 3;
+        }
+        Assembled = true;
+        if (SymbolsPath != nullptr) {
+            FILE* Symbols = fopen(SymbolsPath, "w");
+            if (Symbols != nullptr) {
+                assembler.WriteSymbols(Symbols);
+                fclose(Symbols);
+            }
+        }
+        cpu.program_counter = assembler.Entry;
+        cpu.code_floor = assembler.HasCode ? assembler.LowestCode : assembler.Entry;
+        ticks = assembler.ticks;
+    }
+    else {
+        char* result = cpu.ReadFileInstructions("./program.xndr", arena);
+        if (result == nullptr) {
+            printf("Could not read program.xndr. Exit");
+            return 4;
+        }
+        ticks = cpu.splitByNewLine(result, memory);
+    }
+    if (devices != nullptr) {
+        devices->Seed(memory);
+    }
+
+    for (int i = 0; i < BreakCount; i++) {
+        memory.SetBreakpoint(Breaks[i]);
+    }
+    for (int i = 0; i < ReadWatchCount; i++) {
+        memory.SetReadWatch(ReadWatches[i]);
+    }
+    for (int i = 0; i < WriteWatchCount; i++) {
+        memory.SetWriteWatch(WriteWatches[i]);
+    }
+
+    if (TickBudget > 0) {
+        ticks = TickBudget;
+    }
+
+    // Decode everything reachable from the entry point before it runs
+    CODE_MAP* map = nullptr;
+    if (ListingPath != nullptr) {
+        void* block = arena.Allocate(sizeof(CODE_MAP));
+        FILE* Listing = fopen(ListingPath, "w");
+        if (block == nullptr || Listing == nullptr) {
+            printf("Could not write the listing to %s. Exit", ListingPath);
+            return 4;
+        }
+        map = new (block) CODE_MAP;
+        map->InstructionSet = variant->Instructions;
+        map->Analyze(memory, &cpu.program_counter, 1, arena, Assembled ? &assembler : nullptr);
+        map->WriteListing(Listing, memory);
+        fclose(Listing);
+    }
+
+    if (FuzzWorkers > 0) {
+        int result = Fuzz(*variant, cpu, memory, ticks, FuzzWorkers, FuzzIterations, FuzzSeed,
+            FuzzInputAddress, FuzzInputLength, FuzzStop, FuzzEntry, CorpusPath, DevicesPrefix != nullptr, CheckAllocations);
+        if (result == 0 && MetricsPath != nullptr && !WriteMetrics(MetricsPath)) {
+            return 4;
+        }
+        return result;
+    }
+
+    u64 RunStart = journal.Mark();
+
+    BUS_TRACE trace = { nullptr, cpu.cycles };
+    if (BusTracePath != nullptr) {
+        trace.Output = fopen(BusTracePath, "w");
+        if (trace.Output == nullptr) {
+            printf("Could not create %s. Exit", BusTracePath);
+            return 4;
+        }
+        memory.Listener = BUS_TRACE::Cycle;
+        memory.ListenerContext = &trace;
+    }
+
+    // Saving to the file we restored from only rewrites the pages touched since. A new save
+    // starts with the loaded state, so the file can be restored however the run ends.
+    if (SavePath != nullptr && (RestorePath == nullptr || strcmp(SavePath, RestorePath) != 0)) {
+        if (!state.Create(SavePath) || !state.Checkpoint(cpu, memory, ticks)) {
+            printf("Could not create %s. Exit", SavePath);
+            return 4;
+        }
+    }
+
+    u64 JobStart = Nanoseconds();
+    while (ticks > 0) {
+        s32 slice = (CheckpointEvery > 0 && CheckpointEvery < ticks) ? CheckpointEvery : ticks;
+        s32 left = CycleExact ? variant->CycleExact(cpu, slice, memory) : variant->Fast(cpu, slice, memory);
+        ticks -= slice - left;
+
+        if (SavePath != nullptr && !state.Checkpoint(cpu, memory, ticks)) {
+            printf("Could not write checkpoint %s. Exit", SavePath);
+            return 4;
+        }
+        if (cpu.program_counter < cpu.code_floor) {
+            break;
+        }
+        if (cpu.stop_reason == CPU6502::STOP_BREAKPOINT) {
+            printf("Breakpoint at %d\n", cpu.program_counter);
+            break;
+        }
+        if (cpu.stop_reason == CPU6502::STOP_WATCHPOINT) {
+            printf("Watchpoint %s at %d\n", memory.WatchWasWrite ? "write" : "read", memory.WatchAddress);
+            break;
+        }
+    }
+    shard.JobNanoseconds.Record(Nanoseconds() - JobStart);
+
+    if (devices != nullptr && !devices->Detach()) {
+        printf("Could not write the device output %s. Exit", DevicesPrefix);
+        return 4;
+    }
+
+    arena.Reset();
+
+    if (trace.Output != nullptr) {
+        fclose(trace.Output);
+    }
+
+    if (DeltaPath != nullptr) {
+        FILE* Delta = fopen(DeltaPath, "w");
+        bool written = Delta != nullptr && memory.WriteDelta(Delta, RunStart);
+        if (Delta != nullptr) {
+            fclose(Delta);
+        }
+        if (!written) {
+            printf("Could not write the memory delta to %s, the journal may be too small. Exit", DeltaPath);
+            return 4;
+        }
+    }
+
+    if (MetricsPath != nullptr && !WriteMetrics(MetricsPath)) {
+        return 4;
+    }
+
+    if (CheckAllocations && !NoAllocations(HeapAllocations.load() - AllocationsBefore)) {
+        return 5;
+    }
 
-    if (cpu.program_counter < 0xFF00) {
+    if (cpu.program_counter < cpu.code_floor) {
         printf("Program counter overflow. Exit");
         return 1;
     }